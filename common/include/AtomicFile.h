@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <span>
+#include <string>
+#include <system_error>
+
+// Writes data to name + ".tmp" and renames it into place, so readers never
+// see a half-written file and a crash leaves the old one. False, with the
+// temporary removed, if any step failed.
+inline bool writeFileAtomic(const std::string& name, std::span<const uint8_t> data) {
+  std::string temp = name + ".tmp";
+  bool written;
+  {
+    std::ofstream out(temp, std::ios::binary);
+    written = bool(out.write((const char*)data.data(), data.size()).flush());
+    out.close();
+    written = written && !out.fail();
+  }
+  std::error_code ec;
+  if (written) std::filesystem::rename(temp, name, ec);
+  if (!written || ec) std::filesystem::remove(temp, ec);
+  return written && !ec;
+}
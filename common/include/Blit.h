@@ -0,0 +1,129 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// Run blitters for 24-bit BGR rows. Colours come from a packed palette LUT
+// (see Palette.h) in which zero is transparent, so keyed pixels are left
+// alone. The caller clips; dst points at the first pixel of the run.
+
+inline void blitFillScalar(uint8_t* dst, uint32_t color, size_t n) {
+  if (!color) return;
+  for (size_t i = 0; i < n; i++) {
+    *dst++ = color;
+    *dst++ = color >> 8;
+    *dst++ = color >> 16;
+  }
+}
+
+inline void blitLiteralScalar(uint8_t* dst, const uint8_t* src, size_t n, const uint32_t* lut) {
+  for (size_t i = 0; i < n; i++, dst += 3) {
+    uint32_t color = lut[src[i]];
+    if (!color) continue;
+    dst[0] = color;
+    dst[1] = color >> 8;
+    dst[2] = color >> 16;
+  }
+}
+
+#if defined(__x86_64__)
+// 16 pixels are exactly three 16-byte stores, so long fills never need to
+// read the destination.
+inline void blitFillSse2(uint8_t* dst, uint32_t color, size_t n) {
+  if (!color) return;
+  alignas(16) uint8_t pattern[48];
+  for (size_t i = 0; i < 16; i++) {
+    pattern[i * 3] = color;
+    pattern[i * 3 + 1] = color >> 8;
+    pattern[i * 3 + 2] = color >> 16;
+  }
+  __m128i a = _mm_load_si128((const __m128i*)pattern);
+  __m128i b = _mm_load_si128((const __m128i*)(pattern + 16));
+  __m128i c = _mm_load_si128((const __m128i*)(pattern + 32));
+  for (; n >= 16; n -= 16, dst += 48) {
+    _mm_storeu_si128((__m128i*)dst, a);
+    _mm_storeu_si128((__m128i*)(dst + 16), b);
+    _mm_storeu_si128((__m128i*)(dst + 32), c);
+  }
+  blitFillScalar(dst, color, n);
+}
+
+// Eight pixels per step: gather their LUT entries, pack each 128-bit half to
+// 12 bytes and blend it over the destination so keyed pixels survive. Each
+// half is written as a 16-byte store, so a step touches 4 bytes past its own
+// 24; requiring 10 pixels keeps those bytes inside the run.
+[[gnu::target("avx2")]] inline void blitLiteralAvx2(uint8_t* dst, const uint8_t* src, size_t n, const uint32_t* lut) {
+  const __m256i pack = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                        0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+  const __m256i tail = _mm256_setr_epi32(0, 0, 0, -1, 0, 0, 0, -1);
+  for (; n >= 10; n -= 8, src += 8, dst += 24) {
+    __m256i idx = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)src));
+    __m256i color = _mm256_i32gather_epi32((const int*)lut, idx, 4);
+    __m256i keep = _mm256_cmpeq_epi32(color, _mm256_setzero_si256());
+    keep = _mm256_or_si256(_mm256_shuffle_epi8(keep, pack), tail);
+    color = _mm256_shuffle_epi8(color, pack);
+    __m128i lo = _mm_loadu_si128((const __m128i*)dst);
+    __m128i hi = _mm_loadu_si128((const __m128i*)(dst + 12));
+    lo = _mm_blendv_epi8(_mm256_castsi256_si128(color), lo, _mm256_castsi256_si128(keep));
+    hi = _mm_blendv_epi8(_mm256_extracti128_si256(color, 1), hi, _mm256_extracti128_si256(keep, 1));
+    _mm_storeu_si128((__m128i*)dst, lo);
+    _mm_storeu_si128((__m128i*)(dst + 12), hi);
+  }
+  blitLiteralScalar(dst, src, n, lut);
+}
+
+inline const bool blitHasAvx2 = __builtin_cpu_supports("avx2");
+#endif
+
+// Run blitters for 8-bit indexed rows, where transparentIndex is the key and
+// the source has already been folded onto it (see paletteKey).
+
+inline void blitFillIndexed(uint8_t* dst, uint8_t index, size_t n) {
+  if (index) memset(dst, index, n);
+}
+
+inline void blitLiteralIndexedScalar(uint8_t* dst, const uint8_t* src, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    if (src[i]) dst[i] = src[i];
+  }
+}
+
+#if defined(__x86_64__)
+inline void blitLiteralIndexedSse2(uint8_t* dst, const uint8_t* src, size_t n) {
+  for (; n >= 16; n -= 16, src += 16, dst += 16) {
+    __m128i s = _mm_loadu_si128((const __m128i*)src);
+    __m128i keep = _mm_cmpeq_epi8(s, _mm_setzero_si128());
+    __m128i d = _mm_loadu_si128((const __m128i*)dst);
+    _mm_storeu_si128((__m128i*)dst, _mm_or_si128(_mm_and_si128(keep, d), _mm_andnot_si128(keep, s)));
+  }
+  blitLiteralIndexedScalar(dst, src, n);
+}
+#endif
+
+// Set to route everything through the scalar reference loops.
+inline bool blitReference = false;
+
+inline void blitFill(uint8_t* dst, uint32_t color, size_t n) {
+#if defined(__x86_64__)
+  if (!blitReference && n >= 16) return blitFillSse2(dst, color, n);
+#endif
+  blitFillScalar(dst, color, n);
+}
+
+inline void blitLiteral(uint8_t* dst, const uint8_t* src, size_t n, const uint32_t* lut) {
+#if defined(__x86_64__)
+  if (!blitReference && blitHasAvx2 && n >= 10) return blitLiteralAvx2(dst, src, n, lut);
+#endif
+  blitLiteralScalar(dst, src, n, lut);
+}
+
+inline void blitLiteralIndexed(uint8_t* dst, const uint8_t* src, size_t n) {
+#if defined(__x86_64__)
+  if (!blitReference && n >= 16) return blitLiteralIndexedSse2(dst, src, n);
+#endif
+  blitLiteralIndexedScalar(dst, src, n);
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <span>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Output files keyed by a hash of their content (see Hash.h). The first
+// file with a given content is written as usual; later ones become hard
+// links to it, or copies where the filesystem cannot link. Content is given
+// as the spans of source data the file is made from, which must stay valid,
+// such as parts of a mapped archive; files only count as the same if those
+// bytes are equal, not just their hashes.
+struct DedupFiles {
+  using Content = std::vector<std::span<const uint8_t>>;
+  std::unordered_multimap<uint64_t, std::pair<std::string, Content>> written;
+  size_t files = 0, links = 0, bytesSaved = 0;
+  // If the same content has been written before, makes name a link to that
+  // file and returns it. Otherwise remembers name as the file for this
+  // content and returns nullptr; the caller then writes it. Either way
+  // whatever was at name is removed first, so a link left by an earlier run
+  // is never written through.
+  const std::string* link(uint64_t hash, const std::string& name, const Content& content) {
+    files++;
+    std::error_code ec;
+    std::filesystem::remove(name, ec);
+    auto [begin, end] = written.equal_range(hash);
+    auto it = std::find_if(begin, end, [&](const auto& w) { return same(w.second.second, content); });
+    if (it == end) {
+      written.emplace(hash, std::make_pair(name, content));
+      return nullptr;
+    }
+    const std::string& first = it->second.first;
+    std::filesystem::create_hard_link(first, name, ec);
+    if (ec) std::filesystem::copy_file(first, name, std::filesystem::copy_options::overwrite_existing);
+    links++;
+    bytesSaved += std::filesystem::file_size(name, ec);
+    return &first;
+  }
+  static bool same(const Content& a, const Content& b) {
+    return std::equal(a.begin(), a.end(), b.begin(), b.end(), [](auto x, auto y) {
+      return std::equal(x.begin(), x.end(), y.begin(), y.end());
+    });
+  }
+  void report(const char* what) const {
+    printf("%zu %s, %zu unique, %zu written as hard links saving %zu bytes\n", files, what, files - links, links, bytesSaved);
+  }
+};
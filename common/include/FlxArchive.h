@@ -0,0 +1,45 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <span>
+#include "MappedFile.h"
+
+struct Header {
+  char tag[84];
+  uint32_t fileCount;
+  uint32_t one;
+  uint32_t fileSize;
+  uint32_t pad[8];
+};
+
+struct FileEntry {
+  uint32_t offset;
+  uint32_t size;
+};
+
+// Read-only view of a whole FLX archive. The file is mapped once and every
+// entry is handed out as a span into the mapping, so nothing is copied and
+// nothing needs to be extracted to disk first.
+struct FlxArchive : MappedFile {
+  using MappedFile::MappedFile;
+  const Header* header() const {
+    return reinterpret_cast<const Header*>(base);
+  }
+  std::span<const FileEntry> entries() const {
+    if (length < sizeof(Header)) return {};
+    const FileEntry* first = reinterpret_cast<const FileEntry*>(header() + 1);
+    size_t count = std::min<size_t>(header()->fileCount, (length - sizeof(Header)) / sizeof(FileEntry));
+    return {first, count};
+  }
+  size_t size() const {
+    return entries().size();
+  }
+  // Empty for unused slots and for entries that point outside the file.
+  std::span<const uint8_t> operator[](size_t index) const {
+    auto e = entries();
+    if (index >= e.size() || e[index].offset == 0) return {};
+    if (e[index].offset > length || e[index].size > length - e[index].offset) return {};
+    return {base + e[index].offset, e[index].size};
+  }
+};
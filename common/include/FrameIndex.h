@@ -0,0 +1,217 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <span>
+#include <string>
+#include <vector>
+#include "AtomicFile.h"
+#include "FlxArchive.h"
+#include "Hash.h"
+#include "MappedFile.h"
+#include "Rle.h"
+#include "Shape.h"
+
+struct [[gnu::packed]] FrameIndexHeader {
+  char magic[4];
+  uint32_t version;
+  uint64_t archiveSize;
+  int64_t archiveTime;
+  uint32_t shapes;
+  uint32_t frames;
+};
+
+// One frame of a shape archive. offset is where its FrameData starts in the
+// archive file and size, for valid frames, how many bytes from there its
+// header, row offsets and runs take up. pixels hashes everything that decides the frame's pixels,
+// its compression, size and RLE data but not its offsets, so frames with
+// equal hashes decode to the same image. Frames that failed validateFrame
+// have valid cleared and nothing but their offset and size filled in.
+struct [[gnu::packed]] FrameIndexEntry {
+  uint64_t pixels;
+  uint32_t offset;
+  uint32_t size;
+  uint32_t width;
+  uint32_t height;
+  int32_t offx;
+  int32_t offy;
+  uint32_t opaque;
+  uint8_t compression;
+  uint8_t valid;
+  uint16_t pad;
+};
+
+static_assert(sizeof(FrameIndexEntry) == 40);
+
+// The bytes a valid frame's pixel hash is made from: compression and size,
+// then the row offsets and runs, so frames with equal content have equal
+// pixels whatever their hashes say.
+using PixelContent = std::vector<std::span<const uint8_t>>;
+inline PixelContent pixelContent(const FrameData* fdata, const FrameIndexEntry& e) {
+  const uint8_t* start = reinterpret_cast<const uint8_t*>(fdata);
+  return {{start + offsetof(FrameData, compression), 12}, {start + offsetof(FrameData, rowOffsets), start + e.size}};
+}
+inline bool samePixels(const PixelContent& a, const PixelContent& b) {
+  return std::equal(a.begin(), a.end(), b.begin(), b.end(), [](auto x, auto y) {
+    return std::equal(x.begin(), x.end(), y.begin(), y.end());
+  });
+}
+
+// Every frame of a shape archive in one table, so tools can look up frame
+// counts, sizes and offsets without touching the shapes themselves. Built
+// by scanning and validating the archive once and saved as <archive>.fidx:
+// the header, then the index of each shape's first frame (one more than
+// there are shapes), then the frames. The file is used in place through a
+// read-only mapping, and rebuilt when the archive's size or modification
+// time no longer match or its frames do not fit the archive. An index that
+// cannot be saved is used from memory.
+struct FrameIndex {
+  static constexpr uint32_t version = 3;
+  MappedFile file;
+  std::vector<uint8_t> memory;
+  const FrameIndexHeader* header = nullptr;
+  const uint32_t* shapeStart = nullptr;
+  const FrameIndexEntry* entries = nullptr;
+  size_t shapes() const {
+    return header ? header->shapes : 0;
+  }
+  std::span<const FrameIndexEntry> frames(size_t shape) const {
+    if (shape >= shapes()) return {};
+    return {entries + shapeStart[shape], entries + shapeStart[shape + 1]};
+  }
+  size_t frameCount(size_t shape) const {
+    return frames(shape).size();
+  }
+  // The frame's data in the archive, or null if it is invalid.
+  const FrameData* frameData(const FlxArchive& archive, size_t shape, size_t frame) const {
+    auto f = frames(shape);
+    if (frame >= f.size() || !f[frame].valid) return nullptr;
+    return reinterpret_cast<const FrameData*>(archive.base + f[frame].offset);
+  }
+  // How far any valid frame reaches from the point it is drawn at: offx
+  // pixels left and width - offx right of it, offy up and height - offy down.
+  struct Reach {
+    int64_t left = 0, right = 0, up = 0, down = 0;
+  };
+  Reach reach() const {
+    Reach r;
+    for (size_t n = 0; header && n < header->frames; n++) {
+      const FrameIndexEntry& e = entries[n];
+      if (!e.valid) continue;
+      r.left = std::max<int64_t>(r.left, e.offx);
+      r.right = std::max<int64_t>(r.right, int64_t(e.width) - e.offx);
+      r.up = std::max<int64_t>(r.up, e.offy);
+      r.down = std::max<int64_t>(r.down, int64_t(e.height) - e.offy);
+    }
+    return r;
+  }
+  // The whole index as it is laid out in the file.
+  static std::vector<uint8_t> build(const FlxArchive& archive, const std::string& archiveName) {
+    std::vector<uint32_t> starts;
+    std::vector<FrameIndexEntry> frames;
+    for (size_t n = 0; n < archive.size(); n++) {
+      starts.push_back(frames.size());
+      std::span<const uint8_t> data = archive[n];
+      const FrameHeader* fhs = reinterpret_cast<const FrameHeader*>(data.data() + sizeof(ShpHeader));
+      for (size_t f = 0; f < framesInShape(data); f++) {
+        FrameIndexEntry e{};
+        size_t start = fhs[f].frameOffset & 0x7FFFFFFF, end;
+        e.offset = data.data() - archive.base + start;
+        e.size = fhs[f].framesize;
+        if (!validateFrame(data, f, &end)) {
+          const FrameData* fdata = reinterpret_cast<const FrameData*>(archive.base + e.offset);
+          const uint8_t* rows = reinterpret_cast<const uint8_t*>(fdata->rowOffsets);
+          e.pixels = hashCombine(hash64({reinterpret_cast<const uint8_t*>(&fdata->compression), 12}),
+                                 hash64({rows, data.data() + end}));
+          OpaqueSink opaque;
+          decodeRle(fdata, opaque);
+          e.size = end - start;
+          e.width = fdata->width;
+          e.height = fdata->height;
+          e.offx = fdata->offx;
+          e.offy = fdata->offy;
+          e.opaque = opaque.count;
+          e.compression = fdata->compression;
+          e.valid = 1;
+        }
+        frames.push_back(e);
+      }
+    }
+    starts.push_back(frames.size());
+    FrameIndexHeader header{{'C', 'N', 'R', 'F'}, version, std::filesystem::file_size(archiveName),
+                            std::filesystem::last_write_time(archiveName).time_since_epoch().count(),
+                            uint32_t(starts.size() - 1), uint32_t(frames.size())};
+    std::vector<uint8_t> image(sizeof(header) + starts.size() * sizeof(uint32_t) + frames.size() * sizeof(FrameIndexEntry));
+    memcpy(image.data(), &header, sizeof(header));
+    memcpy(image.data() + sizeof(header), starts.data(), starts.size() * sizeof(uint32_t));
+    memcpy(image.data() + sizeof(header) + starts.size() * sizeof(uint32_t), frames.data(), frames.size() * sizeof(FrameIndexEntry));
+    return image;
+  }
+  // Points the tables into an index image.
+  void use(const uint8_t* image) {
+    header = reinterpret_cast<const FrameIndexHeader*>(image);
+    shapeStart = reinterpret_cast<const uint32_t*>(header + 1);
+    entries = reinterpret_cast<const FrameIndexEntry*>(shapeStart + header->shapes + 1);
+  }
+  // False if the file is missing, malformed, older than the archive or has
+  // shapes or frames that do not fit it.
+  bool load(const std::string& name, const FlxArchive& archive, const std::string& archiveName) {
+    std::error_code ec;
+    if (!std::filesystem::exists(name, ec)) return false;
+    MappedFile mapped(name);
+    if (mapped.length < sizeof(FrameIndexHeader)) return false;
+    const FrameIndexHeader* h = reinterpret_cast<const FrameIndexHeader*>(mapped.base);
+    if (memcmp(h->magic, "CNRF", 4) || h->version != version ||
+        h->archiveSize != std::filesystem::file_size(archiveName, ec) ||
+        h->archiveTime != std::filesystem::last_write_time(archiveName, ec).time_since_epoch().count() || ec) {
+      return false;
+    }
+    if (mapped.length != sizeof(FrameIndexHeader) + (size_t(h->shapes) + 1) * sizeof(uint32_t) + size_t(h->frames) * sizeof(FrameIndexEntry)) {
+      return false;
+    }
+    // Callers validate frames by index number, so every shape has to have
+    // as many entries as the archive has frame headers.
+    if (h->shapes != archive.size()) return false;
+    const uint32_t* starts = reinterpret_cast<const uint32_t*>(h + 1);
+    for (size_t n = 0; n < h->shapes; n++) {
+      if (starts[n] > starts[n + 1] || starts[n + 1] - starts[n] != framesInShape(archive[n])) return false;
+    }
+    if (starts[h->shapes] != h->frames) return false;
+    // Valid frames are decoded without bounds checks, so each has to lie
+    // inside the archive and agree with the frame header it points at.
+    const FrameIndexEntry* e = reinterpret_cast<const FrameIndexEntry*>(starts + h->shapes + 1);
+    for (size_t n = 0; n < h->frames; n++) {
+      if (!e[n].valid) continue;
+      if (e[n].offset > archive.length || e[n].size > archive.length - e[n].offset ||
+          e[n].size < offsetof(FrameData, rowOffsets)) {
+        return false;
+      }
+      const FrameData* fdata = reinterpret_cast<const FrameData*>(archive.base + e[n].offset);
+      if (fdata->width != e[n].width || fdata->height != e[n].height || fdata->offx != e[n].offx ||
+          fdata->offy != e[n].offy || fdata->compression != e[n].compression ||
+          fdata->height > (e[n].size - offsetof(FrameData, rowOffsets)) / sizeof(uint32_t)) {
+        return false;
+      }
+    }
+    file = std::move(mapped);
+    use(file.base);
+    return true;
+  }
+};
+
+// The index stored next to the archive if it is current; otherwise a freshly
+// built one, which is saved for next time if the directory allows.
+inline FrameIndex indexFrames(const FlxArchive& archive, const std::string& archiveName) {
+  FrameIndex index;
+  std::string name = archiveName + ".fidx";
+  if (index.load(name, archive, archiveName)) return index;
+  index.memory = FrameIndex::build(archive, archiveName);
+  if (!writeFileAtomic(name, index.memory)) fprintf(stderr, "%s: cannot save the frame index, using it from memory\n", name.c_str());
+  index.use(index.memory.data());
+  return index;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <span>
+
+// Fast non-cryptographic 64-bit hashing, for spotting changed or duplicate
+// data. Eight bytes per multiply, finished with the murmur3 avalanche.
+
+inline uint64_t hashMix(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xFF51AFD7ED558CCDULL;
+  h ^= h >> 33;
+  h *= 0xC4CEB9FE1A85EC53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+inline uint64_t hashCombine(uint64_t seed, uint64_t value) {
+  return hashMix(seed ^ (value + 0x9E3779B97F4A7C15ULL + (seed << 6) + (seed >> 2)));
+}
+
+inline uint64_t hash64(std::span<const uint8_t> data, uint64_t seed = 0) {
+  uint64_t h = seed ^ (data.size() * 0x9E3779B97F4A7C15ULL);
+  size_t n = 0;
+  for (; n + 8 <= data.size(); n += 8) {
+    uint64_t word;
+    memcpy(&word, data.data() + n, 8);
+    h = (h ^ hashMix(word)) * 0x9E3779B97F4A7C15ULL;
+  }
+  uint64_t tail = 0;
+  if (n < data.size()) memcpy(&tail, data.data() + n, data.size() - n);
+  return hashMix(h ^ hashMix(tail ^ 0x94D049BB133111EBULL));
+}
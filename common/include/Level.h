@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <span>
+#include <vector>
+#include "FlxArchive.h"
+
+struct [[gnu::packed]] Entry {
+  uint16_t x;
+  uint16_t y;
+  uint8_t z;
+  uint16_t type;
+  uint8_t frame;
+  uint16_t flags;
+  uint16_t count;
+  uint8_t npcIndex;
+  uint8_t mapIndex;
+  uint16_t nextObj;
+};
+
+struct [[gnu::packed]] GlobEntry {
+  uint8_t x;
+  uint8_t y;
+  uint8_t z;
+  uint16_t shapeindex;
+  uint8_t frame;
+};
+
+static_assert(sizeof(Entry) == 16);
+
+struct Shape {
+    uint16_t shape;
+    uint8_t frame;
+    int x, y, z;
+};
+
+// Globs from glob.flx, each expanded the first time a level uses it into
+// shapes relative to the glob entry's position. Placing a glob is then a
+// plain add over a contiguous array. Safe to share between threads.
+struct GlobCache {
+  GlobCache(const FlxArchive& archive)
+  : archive(archive)
+  , slots(archive.size())
+  {
+  }
+  // nullptr for ids that are out of range or too short to be a glob.
+  const std::vector<Shape>* get(size_t id) {
+    if (id >= slots.size()) return nullptr;
+    Slot& slot = slots[id];
+    std::call_once(slot.once, [&] {
+      std::span<const uint8_t> gv = archive[id];
+      if (gv.size() < 2) return;
+      std::span<const GlobEntry> ge{reinterpret_cast<const GlobEntry*>(gv.data() + 2), (gv.size() - 2) / sizeof(GlobEntry)};
+      slot.shapes.reserve(ge.size());
+      for (auto& e : ge) {
+        slot.shapes.push_back({e.shapeindex, e.frame, e.x*2 - 512, e.y*2 - 512, e.z});
+      }
+      slot.valid = true;
+    });
+    return slot.valid ? &slot.shapes : nullptr;
+  }
+  struct Slot {
+    std::once_flag once;
+    std::vector<Shape> shapes;
+    bool valid = false;
+  };
+  const FlxArchive& archive;
+  std::vector<Slot> slots;
+};
+
+// Calls f(shape) for every object placed in a level file, with globs
+// expanded in place. The file is read a block of entries at a time, so
+// memory use does not grow with the level.
+template <typename F>
+void forEachShape(const std::string& name, GlobCache& globs, F&& f) {
+  std::ifstream in(name, std::ios::binary);
+  if (!in) throw std::system_error(errno, std::generic_category(), name);
+  std::vector<Entry> block(4096);
+  while (in) {
+    in.read(reinterpret_cast<char*>(block.data()), block.size() * sizeof(Entry));
+    size_t count = in.gcount() / sizeof(Entry);
+    for (size_t n = 0; n < count; n++) {
+      const Entry& entry = block[n];
+      if (entry.type == 0x10) {
+        const std::vector<Shape>* glob = globs.get(entry.count);
+        if (!glob) {
+          fprintf(stderr, "invalid glob id %u\n", entry.count);
+          continue;
+        }
+        for (auto& g : *glob) {
+          f(Shape{g.shape, g.frame, entry.x + g.x, entry.y + g.y, entry.z + g.z});
+        }
+      } else {
+        f(Shape{entry.type, entry.frame, entry.x, entry.y, entry.z});
+      }
+    }
+  }
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "AtomicFile.h"
+#include "Hash.h"
+#include "Level.h"
+
+struct [[gnu::packed]] LevelIndexHeader {
+  char magic[4];
+  uint32_t version;
+  uint64_t levelSize;
+  int64_t levelTime;
+  uint64_t globHash;
+  int32_t originX;
+  int32_t originY;
+  uint32_t cellsX;
+  uint32_t cellsY;
+  uint32_t count;
+};
+
+// A Shape as stored in the index, without the in-memory padding.
+struct [[gnu::packed]] LevelIndexShape {
+  uint16_t shape;
+  uint8_t frame;
+  int32_t x;
+  int32_t y;
+  int32_t z;
+};
+
+// Uniform grid over every object in a level, globs expanded, bucketed by
+// world x/y. Each cell's objects are contiguous and keep the level's order,
+// so a region query touches only the cells it overlaps. The index can be
+// saved as <level>.idx and is rebuilt when the level's size or modification
+// time, or the contents of the glob archive it was expanded with, no longer
+// match.
+struct LevelIndex {
+  static constexpr int32_t cellSize = 512;
+  static constexpr uint32_t version = 3;
+  int32_t originX = 0, originY = 0;
+  uint32_t cellsX = 0, cellsY = 0;
+  std::vector<uint32_t> cellStart;
+  std::vector<Shape> shapes;
+  LevelIndex() {
+  }
+  explicit LevelIndex(const std::vector<Shape>& level) {
+    int32_t maxX = INT_MIN, maxY = INT_MIN;
+    originX = originY = INT_MAX;
+    for (auto& s : level) {
+      originX = std::min(originX, s.x);
+      originY = std::min(originY, s.y);
+      maxX = std::max(maxX, s.x);
+      maxY = std::max(maxY, s.y);
+    }
+    if (level.empty()) originX = originY = maxX = maxY = 0;
+    cellsX = (maxX - originX) / cellSize + 1;
+    cellsY = (maxY - originY) / cellSize + 1;
+    // Counting sort into cells, stable so each cell keeps the level's order.
+    cellStart.assign(size_t(cellsX) * cellsY + 1, 0);
+    for (auto& s : level) cellStart[cellOf(s) + 1]++;
+    for (size_t n = 1; n < cellStart.size(); n++) cellStart[n] += cellStart[n - 1];
+    std::vector<uint32_t> next(cellStart.begin(), cellStart.end() - 1);
+    shapes.resize(level.size());
+    for (auto& s : level) shapes[next[cellOf(s)]++] = s;
+  }
+  size_t cellOf(const Shape& s) const {
+    return size_t((s.y - originY) / cellSize) * cellsX + (s.x - originX) / cellSize;
+  }
+  // Calls f(shape) for every object positioned in [x0, x1) x [y0, y1) with
+  // z in [z0, z1).
+  template <typename F>
+  void query(int32_t x0, int32_t y0, int32_t x1, int32_t y1, F&& f, int32_t z0 = INT_MIN, int32_t z1 = INT_MAX) const {
+    if (x0 >= x1 || y0 >= y1 || shapes.empty()) return;
+    int64_t cx0 = std::max<int64_t>(0, (int64_t(x0) - originX) / cellSize);
+    int64_t cy0 = std::max<int64_t>(0, (int64_t(y0) - originY) / cellSize);
+    int64_t cx1 = std::min<int64_t>(cellsX - 1, (int64_t(x1) - 1 - originX) / cellSize);
+    int64_t cy1 = std::min<int64_t>(cellsY - 1, (int64_t(y1) - 1 - originY) / cellSize);
+    if (int64_t(x1) - 1 < originX || int64_t(y1) - 1 < originY) return;
+    for (int64_t cy = cy0; cy <= cy1; cy++) {
+      for (int64_t cx = cx0; cx <= cx1; cx++) {
+        size_t cell = cy * cellsX + cx;
+        for (uint32_t n = cellStart[cell]; n < cellStart[cell + 1]; n++) {
+          const Shape& s = shapes[n];
+          if (s.x >= x0 && s.x < x1 && s.y >= y0 && s.y < y1 && s.z >= z0 && s.z < z1) f(s);
+        }
+      }
+    }
+  }
+  // Written aside and renamed into place like the frame index. False if the
+  // index could not be saved.
+  bool save(const std::string& name, const std::string& level, uint64_t globHash) const {
+    std::error_code ec;
+    LevelIndexHeader header{{'C', 'N', 'R', 'I'}, version, std::filesystem::file_size(level, ec),
+                            std::filesystem::last_write_time(level, ec).time_since_epoch().count(), globHash,
+                            originX, originY, cellsX, cellsY, uint32_t(shapes.size())};
+    if (ec) return false;
+    std::vector<uint8_t> image(sizeof(header) + cellStart.size() * sizeof(uint32_t) + shapes.size() * sizeof(LevelIndexShape));
+    uint8_t* p = image.data();
+    memcpy(p, &header, sizeof(header));
+    p += sizeof(header);
+    memcpy(p, cellStart.data(), cellStart.size() * sizeof(uint32_t));
+    p += cellStart.size() * sizeof(uint32_t);
+    for (auto& s : shapes) {
+      LevelIndexShape out{s.shape, s.frame, s.x, s.y, s.z};
+      memcpy(p, &out, sizeof(out));
+      p += sizeof(out);
+    }
+    return writeFileAtomic(name, image);
+  }
+  // False if the file is missing, malformed, older than the level or built
+  // from other globs.
+  bool load(const std::string& name, const std::string& level, uint64_t globHash) {
+    std::ifstream in(name, std::ios::binary);
+    LevelIndexHeader header;
+    if (!in.read((char*)&header, sizeof(header))) return false;
+    std::error_code ec;
+    if (memcmp(header.magic, "CNRI", 4) || header.version != version ||
+        header.levelSize != std::filesystem::file_size(level, ec) ||
+        header.levelTime != std::filesystem::last_write_time(level, ec).time_since_epoch().count() || ec ||
+        header.globHash != globHash) {
+      return false;
+    }
+    if (std::filesystem::file_size(name, ec) != sizeof(header) + (size_t(header.cellsX) * header.cellsY + 1) * sizeof(uint32_t) + size_t(header.count) * sizeof(LevelIndexShape)) {
+      return false;
+    }
+    originX = header.originX;
+    originY = header.originY;
+    cellsX = header.cellsX;
+    cellsY = header.cellsY;
+    cellStart.resize(size_t(cellsX) * cellsY + 1);
+    in.read((char*)cellStart.data(), cellStart.size() * sizeof(uint32_t));
+    std::vector<LevelIndexShape> stored(header.count);
+    in.read((char*)stored.data(), stored.size() * sizeof(LevelIndexShape));
+    shapes.clear();
+    shapes.reserve(stored.size());
+    for (auto& s : stored) shapes.push_back(Shape{s.shape, s.frame, s.x, s.y, s.z});
+    if (!in || cellStart[0] != 0 || cellStart.back() != shapes.size()) return false;
+    for (size_t n = 1; n < cellStart.size(); n++) {
+      if (cellStart[n - 1] > cellStart[n]) return false;
+    }
+    return true;
+  }
+};
+
+// The index stored next to the level if it is current; otherwise a freshly
+// built one, which is saved for next time.
+inline LevelIndex indexLevel(const std::string& level, GlobCache& globs) {
+  LevelIndex index;
+  std::string name = level + ".idx";
+  uint64_t globHash = hash64(globs.archive.data());
+  if (index.load(name, level, globHash)) return index;
+  std::vector<Shape> shapes;
+  forEachShape(level, globs, [&](const Shape& s) { shapes.push_back(s); });
+  index = LevelIndex(shapes);
+  if (!index.save(name, level, globHash)) fprintf(stderr, "%s: cannot save the level index, using it from memory\n", name.c_str());
+  return index;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// A whole file mapped read-only. Throws if the file cannot be opened or
+// mapped; an empty file maps to an empty span.
+struct MappedFile {
+  MappedFile() {
+  }
+  MappedFile(const std::string& name) {
+    int fd = open(name.c_str(), O_RDONLY);
+    if (fd < 0) throw std::system_error(errno, std::generic_category(), name);
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+      int err = errno;
+      close(fd);
+      throw std::system_error(err, std::generic_category(), name);
+    }
+    length = st.st_size;
+    if (length) {
+      void* p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p == MAP_FAILED) {
+        int err = errno;
+        close(fd);
+        throw std::system_error(err, std::generic_category(), name);
+      }
+      base = static_cast<const uint8_t*>(p);
+    }
+    close(fd);
+  }
+  MappedFile(MappedFile&& rhs)
+  : base(std::exchange(rhs.base, nullptr))
+  , length(std::exchange(rhs.length, 0))
+  {
+  }
+  MappedFile& operator=(MappedFile&& rhs) {
+    std::swap(base, rhs.base);
+    std::swap(length, rhs.length);
+    return *this;
+  }
+  ~MappedFile() {
+    if (base) munmap(const_cast<uint8_t*>(base), length);
+  }
+  std::span<const uint8_t> data() const {
+    return {base, length};
+  }
+  const uint8_t* base = nullptr;
+  size_t length = 0;
+};
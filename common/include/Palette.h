@@ -0,0 +1,103 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+struct Color {
+  uint8_t r, g, b;
+};
+
+inline Color palette[256] = {
+  { 0x00, 0x00, 0x00 }, { 0x3f, 0x3f, 0x2f }, { 0x3e, 0x3c, 0x08 }, { 0x3f, 0x32, 0x07 },
+  { 0x3f, 0x29, 0x05 }, { 0x3f, 0x1f, 0x03 }, { 0x3f, 0x16, 0x02 }, { 0x3f, 0x0c, 0x00 },
+  { 0x00, 0x00, 0x00 }, { 0x3f, 0x3f, 0x11 }, { 0x3f, 0x15, 0x14 }, { 0x13, 0x29, 0x14 },
+  { 0x00, 0x1d, 0x2f }, { 0x3f, 0x3f, 0x33 }, { 0x3f, 0x3f, 0x32 }, { 0x3f, 0x3f, 0x35 },
+  { 0x3f, 0x3f, 0x3f }, { 0x3a, 0x3a, 0x3a }, { 0x35, 0x35, 0x35 }, { 0x30, 0x30, 0x30 },
+  { 0x2b, 0x2b, 0x2b }, { 0x26, 0x26, 0x26 }, { 0x22, 0x22, 0x22 }, { 0x1d, 0x1d, 0x1d },
+  { 0x19, 0x19, 0x19 }, { 0x16, 0x16, 0x16 }, { 0x12, 0x12, 0x12 }, { 0x0e, 0x0e, 0x0e },
+  { 0x0b, 0x0b, 0x0b }, { 0x07, 0x07, 0x07 }, { 0x03, 0x03, 0x03 }, { 0x00, 0x00, 0x00 },
+  { 0x35, 0x1b, 0x11 }, { 0x2e, 0x19, 0x11 }, { 0x27, 0x17, 0x11 }, { 0x21, 0x15, 0x12 },
+  { 0x1a, 0x13, 0x12 }, { 0x13, 0x10, 0x13 }, { 0x0d, 0x0e, 0x13 }, { 0x06, 0x0c, 0x13 },
+  { 0x36, 0x2d, 0x13 }, { 0x31, 0x29, 0x13 }, { 0x2d, 0x24, 0x14 }, { 0x28, 0x20, 0x15 },
+  { 0x23, 0x1c, 0x15 }, { 0x1f, 0x18, 0x16 }, { 0x1a, 0x14, 0x17 }, { 0x15, 0x0f, 0x17 },
+  { 0x36, 0x36, 0x3a }, { 0x31, 0x32, 0x37 }, { 0x2d, 0x2f, 0x33 }, { 0x29, 0x2b, 0x30 },
+  { 0x24, 0x27, 0x2d }, { 0x20, 0x23, 0x29 }, { 0x1b, 0x20, 0x26 }, { 0x17, 0x1c, 0x23 },
+  { 0x13, 0x18, 0x1f }, { 0x10, 0x15, 0x1b }, { 0x0d, 0x11, 0x16 }, { 0x0b, 0x0e, 0x12 },
+  { 0x08, 0x0b, 0x0e }, { 0x05, 0x07, 0x09 }, { 0x03, 0x04, 0x05 }, { 0x3e, 0x3c, 0x08 },
+  { 0x00, 0x18, 0x37 }, { 0x00, 0x0c, 0x1c }, { 0x3e, 0x38, 0x08 }, { 0x22, 0x08, 0x02 },
+  { 0x00, 0x2d, 0x03 }, { 0x00, 0x1b, 0x02 }, { 0x3f, 0x35, 0x07 }, { 0x3f, 0x31, 0x06 },
+  { 0x2d, 0x2c, 0x22 }, { 0x28, 0x27, 0x1d }, { 0x23, 0x22, 0x18 }, { 0x1d, 0x1d, 0x12 },
+  { 0x17, 0x17, 0x0f }, { 0x11, 0x11, 0x0b }, { 0x0a, 0x0a, 0x07 }, { 0x05, 0x05, 0x03 },
+  { 0x36, 0x36, 0x36 }, { 0x35, 0x32, 0x32 }, { 0x32, 0x2e, 0x2e }, { 0x2e, 0x2a, 0x2a },
+  { 0x2a, 0x26, 0x26 }, { 0x27, 0x22, 0x22 }, { 0x23, 0x1e, 0x1e }, { 0x1f, 0x1a, 0x1a },
+  { 0x1d, 0x17, 0x17 }, { 0x1c, 0x14, 0x14 }, { 0x1a, 0x11, 0x11 }, { 0x18, 0x0e, 0x0e },
+  { 0x13, 0x0a, 0x0a }, { 0x0e, 0x07, 0x07 }, { 0x09, 0x04, 0x04 }, { 0x3f, 0x2d, 0x06 },
+  { 0x3f, 0x3f, 0x3a }, { 0x3f, 0x3b, 0x32 }, { 0x3f, 0x2a, 0x05 }, { 0x3f, 0x26, 0x04 },
+  { 0x3f, 0x2f, 0x19 }, { 0x3f, 0x2b, 0x11 }, { 0x3f, 0x27, 0x08 }, { 0x3f, 0x22, 0x04 },
+  { 0x38, 0x1e, 0x00 }, { 0x32, 0x19, 0x00 }, { 0x2b, 0x15, 0x00 }, { 0x24, 0x10, 0x00 },
+  { 0x1e, 0x0b, 0x00 }, { 0x17, 0x06, 0x00 }, { 0x10, 0x01, 0x00 }, { 0x0a, 0x00, 0x00 },
+  { 0x36, 0x2f, 0x2c }, { 0x33, 0x2b, 0x28 }, { 0x31, 0x27, 0x24 }, { 0x2e, 0x23, 0x20 },
+  { 0x2b, 0x1f, 0x1c }, { 0x29, 0x1c, 0x19 }, { 0x24, 0x19, 0x17 }, { 0x1f, 0x16, 0x16 },
+  { 0x1b, 0x14, 0x15 }, { 0x16, 0x11, 0x13 }, { 0x11, 0x0f, 0x12 }, { 0x0d, 0x0c, 0x11 },
+  { 0x0a, 0x0a, 0x0d }, { 0x07, 0x07, 0x0a }, { 0x04, 0x04, 0x06 }, { 0x01, 0x02, 0x03 },
+  { 0x35, 0x3b, 0x36 }, { 0x2e, 0x36, 0x31 }, { 0x26, 0x30, 0x2c }, { 0x1f, 0x2a, 0x27 },
+  { 0x17, 0x24, 0x22 }, { 0x10, 0x1b, 0x1a }, { 0x08, 0x11, 0x12 }, { 0x01, 0x07, 0x09 },
+  { 0x3f, 0x32, 0x2b }, { 0x3a, 0x2b, 0x25 }, { 0x35, 0x24, 0x20 }, { 0x2f, 0x1d, 0x1a },
+  { 0x2a, 0x16, 0x15 }, { 0x24, 0x10, 0x10 }, { 0x1c, 0x0a, 0x0c }, { 0x16, 0x04, 0x07 },
+  { 0x37, 0x34, 0x2a }, { 0x32, 0x31, 0x28 }, { 0x2d, 0x2e, 0x25 }, { 0x28, 0x2b, 0x23 },
+  { 0x22, 0x28, 0x21 }, { 0x1d, 0x25, 0x1f }, { 0x18, 0x22, 0x1d }, { 0x13, 0x1f, 0x1a },
+  { 0x11, 0x1b, 0x18 }, { 0x0f, 0x18, 0x15 }, { 0x0c, 0x14, 0x13 }, { 0x0a, 0x11, 0x10 },
+  { 0x07, 0x0d, 0x0d }, { 0x05, 0x0a, 0x0b }, { 0x03, 0x06, 0x08 }, { 0x00, 0x03, 0x05 },
+  { 0x3f, 0x1e, 0x03 }, { 0x3f, 0x37, 0x2a }, { 0x3f, 0x34, 0x25 }, { 0x3f, 0x32, 0x20 },
+  { 0x36, 0x2c, 0x20 }, { 0x2c, 0x27, 0x1f }, { 0x23, 0x21, 0x1e }, { 0x19, 0x1c, 0x1e },
+  { 0x10, 0x16, 0x1d }, { 0x06, 0x11, 0x1d }, { 0x05, 0x0f, 0x19 }, { 0x04, 0x0c, 0x15 },
+  { 0x03, 0x0a, 0x11 }, { 0x02, 0x07, 0x0d }, { 0x01, 0x05, 0x09 }, { 0x3f, 0x1b, 0x03 },
+  { 0x3d, 0x37, 0x33 }, { 0x3a, 0x35, 0x2f }, { 0x37, 0x32, 0x2a }, { 0x33, 0x2f, 0x25 },
+  { 0x30, 0x2c, 0x20 }, { 0x2c, 0x29, 0x1b }, { 0x29, 0x25, 0x18 }, { 0x26, 0x22, 0x16 },
+  { 0x23, 0x1e, 0x13 }, { 0x1f, 0x1a, 0x10 }, { 0x1a, 0x16, 0x0e }, { 0x16, 0x12, 0x0b },
+  { 0x12, 0x0e, 0x08 }, { 0x0d, 0x0a, 0x05 }, { 0x09, 0x06, 0x02 }, { 0x04, 0x01, 0x00 },
+  { 0x3f, 0x39, 0x2e }, { 0x3c, 0x33, 0x29 }, { 0x38, 0x2d, 0x24 }, { 0x34, 0x26, 0x1e },
+  { 0x30, 0x20, 0x19 }, { 0x2c, 0x19, 0x14 }, { 0x28, 0x13, 0x0e }, { 0x24, 0x0d, 0x09 },
+  { 0x21, 0x06, 0x03 }, { 0x1d, 0x05, 0x03 }, { 0x19, 0x04, 0x02 }, { 0x15, 0x04, 0x02 },
+  { 0x11, 0x03, 0x02 }, { 0x0d, 0x02, 0x01 }, { 0x09, 0x01, 0x01 }, { 0x06, 0x01, 0x01 },
+  { 0x3f, 0x36, 0x2c }, { 0x3c, 0x31, 0x28 }, { 0x39, 0x2d, 0x23 }, { 0x36, 0x29, 0x1f },
+  { 0x33, 0x24, 0x1b }, { 0x2f, 0x20, 0x16 }, { 0x2c, 0x1b, 0x12 }, { 0x2a, 0x18, 0x11 },
+  { 0x28, 0x16, 0x10 }, { 0x26, 0x13, 0x0f }, { 0x24, 0x10, 0x0d }, { 0x22, 0x0d, 0x0c },
+  { 0x1a, 0x0a, 0x0a }, { 0x11, 0x08, 0x08 }, { 0x08, 0x05, 0x06 }, { 0x3f, 0x17, 0x02 },
+  { 0x3f, 0x33, 0x2f }, { 0x3f, 0x30, 0x2c }, { 0x3f, 0x2d, 0x29 }, { 0x3e, 0x2a, 0x26 },
+  { 0x3e, 0x27, 0x23 }, { 0x3d, 0x24, 0x20 }, { 0x3d, 0x20, 0x1e }, { 0x3d, 0x1d, 0x1b },
+  { 0x3c, 0x1a, 0x18 }, { 0x3c, 0x17, 0x15 }, { 0x3b, 0x14, 0x12 }, { 0x3b, 0x11, 0x0f },
+  { 0x3b, 0x0e, 0x0c }, { 0x3a, 0x0b, 0x0a }, { 0x3a, 0x07, 0x07 }, { 0x39, 0x04, 0x04 },
+  { 0x39, 0x02, 0x02 }, { 0x35, 0x02, 0x02 }, { 0x31, 0x01, 0x01 }, { 0x2e, 0x01, 0x01 },
+  { 0x2a, 0x01, 0x01 }, { 0x26, 0x01, 0x01 }, { 0x22, 0x01, 0x01 }, { 0x1e, 0x01, 0x01 },
+  { 0x1b, 0x01, 0x01 }, { 0x17, 0x01, 0x01 }, { 0x13, 0x01, 0x01 }, { 0x3f, 0x13, 0x01 },
+  { 0x3f, 0x10, 0x01 }, { 0x08, 0x00, 0x00 }, { 0x3f, 0x0c, 0x00 }, { 0x0c, 0x2e, 0x2b },
+};
+
+// The palette expanded once to 8-bit BGR, packed little-endian into a 32-bit
+// word so one load gives all three bytes. Palette entries are 6-bit, so only
+// true black packs to zero, and zero doubles as the transparent key.
+inline std::array<uint32_t, 256> makePaletteLut() {
+  std::array<uint32_t, 256> lut;
+  for (size_t n = 0; n < 256; n++) {
+    lut[n] = (palette[n].b << 2) | (palette[n].g << 10) | (palette[n].r << 18);
+  }
+  return lut;
+}
+
+inline const std::array<uint32_t, 256> paletteLut = makePaletteLut();
+
+// Indexed framebuffers reserve index 0, which is black, as transparent.
+// Every index whose colour is keyed folds onto it, so an 8-bit blit only has
+// to test for zero.
+inline constexpr uint8_t transparentIndex = 0;
+
+inline std::array<uint8_t, 256> makePaletteKey() {
+  std::array<uint8_t, 256> key;
+  for (size_t n = 0; n < 256; n++) {
+    key[n] = paletteLut[n] ? n : transparentIndex;
+  }
+  return key;
+}
+
+inline const std::array<uint8_t, 256> paletteKey = makePaletteKey();
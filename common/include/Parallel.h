@@ -0,0 +1,33 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+inline size_t workerCount(size_t requested) {
+  if (requested) return requested;
+  size_t n = std::thread::hardware_concurrency();
+  return n ? n : 1;
+}
+
+// Runs f(index, worker) for every index in [0, count) on up to `threads`
+// workers. Indices are handed out one at a time, so uneven jobs balance
+// themselves. Worker 0 is the calling thread.
+template <typename F>
+void parallelFor(size_t count, size_t threads, F&& f) {
+  std::atomic<size_t> next{0};
+  auto work = [&](size_t worker) {
+    for (size_t n = next++; n < count; n = next++) {
+      f(n, worker);
+    }
+  };
+  std::vector<std::thread> pool;
+  for (size_t t = 1; t < threads && t < count; t++) {
+    pool.emplace_back(work, t);
+  }
+  work(0);
+  for (auto& t : pool) {
+    t.join();
+  }
+}
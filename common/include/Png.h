@@ -0,0 +1,457 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "Palette.h"
+#include "Parallel.h"
+
+// Self-contained PNG writer. Deflate uses LZ77 over hash chains and the fixed
+// Huffman code, which gets most of the win on our long runs of background
+// without the bookkeeping of dynamic trees.
+
+inline constexpr std::array<uint32_t, 256> crcTable = [] {
+  std::array<uint32_t, 256> table{};
+  for (uint32_t n = 0; n < 256; n++) {
+    uint32_t c = n;
+    for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+    table[n] = c;
+  }
+  return table;
+}();
+
+inline uint32_t crc32(uint32_t crc, std::span<const uint8_t> data) {
+  crc = ~crc;
+  for (uint8_t b : data) crc = crcTable[(crc ^ b) & 0xFF] ^ (crc >> 8);
+  return ~crc;
+}
+
+inline uint32_t adler32(uint32_t adler, std::span<const uint8_t> data) {
+  uint32_t a = adler & 0xFFFF, b = adler >> 16;
+  while (!data.empty()) {
+    // 5552 bytes is the most that can be summed before b overflows.
+    size_t n = std::min<size_t>(data.size(), 5552);
+    for (size_t i = 0; i < n; i++) {
+      a += data[i];
+      b += a;
+    }
+    a %= 65521;
+    b %= 65521;
+    data = data.subspan(n);
+  }
+  return a | (b << 16);
+}
+
+// Checksum of A followed by B, from the checksums of both and the length of B.
+inline uint32_t adler32Combine(uint32_t adler1, uint32_t adler2, size_t len2) {
+  constexpr uint32_t base = 65521;
+  uint32_t rem = len2 % base;
+  uint32_t a = (adler1 & 0xFFFF) + (adler2 & 0xFFFF) + base - 1;
+  uint32_t b = uint32_t((uint64_t(rem) * (adler1 & 0xFFFF)) % base) + (adler1 >> 16) + (adler2 >> 16) + base - rem;
+  return (a % base) | ((b % base) << 16);
+}
+
+struct BitWriter {
+  std::vector<uint8_t>& out;
+  uint64_t bits = 0;
+  int count = 0;
+  void put(uint32_t value, int n) {
+    bits |= uint64_t(value) << count;
+    count += n;
+    while (count >= 8) {
+      out.push_back(bits);
+      bits >>= 8;
+      count -= 8;
+    }
+  }
+  // Huffman codes are defined MSB first.
+  void putCode(uint32_t code, int n) {
+    uint32_t reversed = 0;
+    for (int i = 0; i < n; i++) reversed |= ((code >> i) & 1) << (n - 1 - i);
+    put(reversed, n);
+  }
+  void align() {
+    if (count) put(0, 8 - count);
+  }
+};
+
+inline constexpr std::array<uint16_t, 29> deflateLengthBase = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+inline constexpr std::array<uint8_t, 29> deflateLengthExtra = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+inline constexpr std::array<uint16_t, 30> deflateDistBase = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+inline constexpr std::array<uint8_t, 30> deflateDistExtra = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+inline void putFixedSymbol(BitWriter& bw, uint32_t sym) {
+  if (sym < 144) bw.putCode(0x30 + sym, 8);
+  else if (sym < 256) bw.putCode(0x190 + sym - 144, 9);
+  else if (sym < 280) bw.putCode(sym - 256, 7);
+  else bw.putCode(0xC0 + sym - 280, 8);
+}
+
+// Compresses data as one fixed-Huffman block. Unless it is the last block the
+// stream is then byte-aligned with an empty stored block, like zlib's
+// Z_SYNC_FLUSH, so independently compressed pieces can simply be concatenated.
+inline void deflateBlock(std::span<const uint8_t> data, bool last, std::vector<uint8_t>& out) {
+  constexpr uint32_t none = 0xFFFFFFFF;
+  constexpr size_t maxChain = 32;
+  BitWriter bw{out};
+  bw.put(last, 1);
+  bw.put(1, 2);
+  std::vector<uint32_t> head(1 << 15, none), prev(data.size());
+  auto hash = [&](size_t i) {
+    return ((data[i] << 10) ^ (data[i + 1] << 5) ^ data[i + 2]) & 0x7FFF;
+  };
+  auto insert = [&](size_t i) {
+    if (i + 3 > data.size()) return;
+    uint32_t h = hash(i);
+    prev[i] = head[h];
+    head[h] = i;
+  };
+  for (size_t i = 0; i < data.size();) {
+    size_t best = 0, dist = 0;
+    if (i + 3 <= data.size()) {
+      size_t limit = std::min<size_t>(258, data.size() - i);
+      size_t chain = 0;
+      for (uint32_t cand = head[hash(i)]; cand != none && i - cand <= 32768 && chain < maxChain; cand = prev[cand], chain++) {
+        if (data[cand + best] != data[i + best]) continue;
+        size_t len = 0;
+        while (len < limit && data[cand + len] == data[i + len]) len++;
+        if (len > best) {
+          best = len;
+          dist = i - cand;
+          if (len == limit) break;
+        }
+      }
+    }
+    if (best >= 3) {
+      size_t l = std::upper_bound(deflateLengthBase.begin(), deflateLengthBase.end(), best) - deflateLengthBase.begin() - 1;
+      putFixedSymbol(bw, 257 + l);
+      bw.put(best - deflateLengthBase[l], deflateLengthExtra[l]);
+      size_t d = std::upper_bound(deflateDistBase.begin(), deflateDistBase.end(), dist) - deflateDistBase.begin() - 1;
+      bw.putCode(d, 5);
+      bw.put(dist - deflateDistBase[d], deflateDistExtra[d]);
+      for (size_t end = i + best; i < end; i++) insert(i);
+    } else {
+      putFixedSymbol(bw, data[i]);
+      insert(i);
+      i++;
+    }
+  }
+  putFixedSymbol(bw, 256);
+  if (!last) {
+    bw.put(0, 3);
+    bw.align();
+    out.insert(out.end(), {0x00, 0x00, 0xFF, 0xFF});
+  }
+  bw.align();
+}
+
+enum class PngColor : uint8_t {
+  rgb = 2,
+  indexed = 3,
+};
+
+inline void writePngChunk(std::ofstream& out, const char* type, std::span<const uint8_t> data) {
+  uint8_t head[8] = {uint8_t(data.size() >> 24), uint8_t(data.size() >> 16), uint8_t(data.size() >> 8), uint8_t(data.size()),
+                     uint8_t(type[0]), uint8_t(type[1]), uint8_t(type[2]), uint8_t(type[3])};
+  uint32_t crc = crc32(crc32(0, std::span(head + 4, 4)), data);
+  uint8_t tail[4] = {uint8_t(crc >> 24), uint8_t(crc >> 16), uint8_t(crc >> 8), uint8_t(crc)};
+  out.write((const char*)head, 8);
+  out.write((const char*)data.data(), data.size());
+  out.write((const char*)tail, 4);
+}
+
+// Picks the PNG filter with the smallest sum of absolute residuals, the usual
+// heuristic. Indexed images are left unfiltered, as the PNG spec recommends.
+inline void filterRow(const uint8_t* row, const uint8_t* above, size_t bytes, size_t bpp, bool adaptive, uint8_t* out) {
+  if (!adaptive) {
+    out[0] = 0;
+    memcpy(out + 1, row, bytes);
+    return;
+  }
+  auto predict = [&](int type, size_t i) -> uint8_t {
+    int a = i >= bpp ? row[i - bpp] : 0, b = above ? above[i] : 0, c = i >= bpp && above ? above[i - bpp] : 0;
+    switch (type) {
+    case 1: return a;
+    case 2: return b;
+    case 3: return (a + b) / 2;
+    case 4: {
+      int p = a + b - c, pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+      return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+    }
+    default: return 0;
+    }
+  };
+  int bestType = 0;
+  size_t bestSum = SIZE_MAX;
+  for (int type = 0; type < 5; type++) {
+    size_t sum = 0;
+    for (size_t i = 0; i < bytes && sum < bestSum; i++) sum += std::abs(int8_t(row[i] - predict(type, i)));
+    if (sum < bestSum) {
+      bestSum = sum;
+      bestType = type;
+    }
+  }
+  out[0] = bestType;
+  for (size_t i = 0; i < bytes; i++) out[i + 1] = row[i] - predict(bestType, i);
+}
+
+// Writes a w x h PNG whose rows come from row(y, out), which fills w pixels of
+// RGB or palette indices and must be safe to call from several threads. Rows
+// are filtered and deflated in independent blocks of about 1 MB on up to
+// `threads` workers, pigz-style, and written in order, so only one batch of
+// blocks is ever held in memory. Indexed images use the game palette.
+// Returns false if the file could not be written in full.
+template <typename Row>
+[[nodiscard]] bool savePng(const std::string& name, size_t w, size_t h, PngColor color, Row&& row, size_t threads = 1) {
+  size_t bpp = color == PngColor::rgb ? 3 : 1;
+  size_t bytes = w * bpp;
+  size_t blockRows = std::max<size_t>(1, (1 << 20) / (bytes + 1));
+  size_t blockCount = (h + blockRows - 1) / blockRows;
+  std::ofstream out(name, std::ios::binary);
+  static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+  out.write((const char*)signature, 8);
+  uint8_t ihdr[13] = {uint8_t(w >> 24), uint8_t(w >> 16), uint8_t(w >> 8), uint8_t(w),
+                      uint8_t(h >> 24), uint8_t(h >> 16), uint8_t(h >> 8), uint8_t(h),
+                      8, uint8_t(color), 0, 0, 0};
+  writePngChunk(out, "IHDR", ihdr);
+  if (color == PngColor::indexed) {
+    std::array<uint8_t, 768> plte;
+    for (size_t n = 0; n < 256; n++) {
+      plte[n * 3] = paletteLut[n] >> 16;
+      plte[n * 3 + 1] = paletteLut[n] >> 8;
+      plte[n * 3 + 2] = paletteLut[n];
+    }
+    writePngChunk(out, "PLTE", plte);
+  }
+  struct Block {
+    std::vector<uint8_t> data;
+    uint32_t adler;
+    size_t raw;
+  };
+  std::vector<Block> batch(std::max<size_t>(1, threads) * 2);
+  uint32_t adler = 1;
+  if (blockCount == 0) {
+    // No rows still needs a complete zlib stream: header, an empty final
+    // block and the checksum of nothing.
+    std::vector<uint8_t> empty = {0x78, 0x01};
+    deflateBlock({}, true, empty);
+    writePngChunk(out, "IDAT", empty);
+  }
+  for (size_t first = 0; first < blockCount; first += batch.size()) {
+    size_t count = std::min(batch.size(), blockCount - first);
+    parallelFor(count, threads, [&](size_t n, size_t) {
+      size_t y0 = (first + n) * blockRows, y1 = std::min(h, y0 + blockRows);
+      std::vector<uint8_t> rows((y1 - y0 + 1) * bytes), filtered((y1 - y0) * (bytes + 1));
+      if (y0) row(y0 - 1, rows.data());
+      for (size_t y = y0; y < y1; y++) {
+        row(y, rows.data() + (y - y0 + 1) * bytes);
+        filterRow(rows.data() + (y - y0 + 1) * bytes, y ? rows.data() + (y - y0) * bytes : nullptr, bytes, bpp,
+                  color == PngColor::rgb, filtered.data() + (y - y0) * (bytes + 1));
+      }
+      Block& block = batch[n];
+      block.data.clear();
+      if (first + n == 0) block.data = {0x78, 0x01};
+      deflateBlock(filtered, first + n + 1 == blockCount, block.data);
+      block.adler = adler32(1, filtered);
+      block.raw = filtered.size();
+    });
+    for (size_t n = 0; n < count; n++) {
+      writePngChunk(out, "IDAT", batch[n].data);
+      adler = adler32Combine(adler, batch[n].adler, batch[n].raw);
+    }
+  }
+  uint8_t trailer[4] = {uint8_t(adler >> 24), uint8_t(adler >> 16), uint8_t(adler >> 8), uint8_t(adler)};
+  writePngChunk(out, "IDAT", trailer);
+  writePngChunk(out, "IEND", {});
+  out.close();
+  return !out.fail();
+}
+
+// Reading back, for tools that update earlier output in place. Inflate
+// handles all three block types; loadPng only the 8-bit, non-interlaced RGB
+// and palette images savePng writes.
+
+struct BitReader {
+  std::span<const uint8_t> data;
+  size_t pos = 0;
+  uint64_t bits = 0;
+  int count = 0;
+  uint32_t get(int n) {
+    while (count < n) {
+      if (pos >= data.size()) throw std::runtime_error("truncated deflate stream");
+      bits |= uint64_t(data[pos++]) << count;
+      count += 8;
+    }
+    uint32_t value = bits & ((uint64_t(1) << n) - 1);
+    bits >>= n;
+    count -= n;
+    return value;
+  }
+  void align() {
+    bits >>= count % 8;
+    count -= count % 8;
+  }
+};
+
+// Canonical Huffman decoding table, read a bit at a time.
+struct Huffman {
+  uint16_t counts[16] = {};
+  uint16_t symbols[288] = {};
+  Huffman(const uint8_t* lengths, size_t n) {
+    for (size_t i = 0; i < n; i++) counts[lengths[i]]++;
+    counts[0] = 0;
+    uint16_t offsets[16] = {};
+    for (size_t len = 1; len < 16; len++) offsets[len] = offsets[len - 1] + counts[len - 1];
+    for (size_t i = 0; i < n; i++) {
+      if (lengths[i]) symbols[offsets[lengths[i]]++] = i;
+    }
+  }
+  uint32_t decode(BitReader& in) const {
+    int code = 0, first = 0, index = 0;
+    for (size_t len = 1; len < 16; len++) {
+      code |= in.get(1);
+      int count = counts[len];
+      if (code - first < count) return symbols[index + code - first];
+      index += count;
+      first = (first + count) << 1;
+      code <<= 1;
+    }
+    throw std::runtime_error("bad Huffman code");
+  }
+};
+
+inline std::vector<uint8_t> inflate(std::span<const uint8_t> data) {
+  std::vector<uint8_t> out;
+  BitReader in{data};
+  bool last = false;
+  while (!last) {
+    last = in.get(1);
+    uint32_t type = in.get(2);
+    if (type == 0) {
+      in.align();
+      uint32_t len = in.get(16);
+      if ((len ^ 0xFFFF) != in.get(16)) throw std::runtime_error("bad stored block");
+      for (size_t n = 0; n < len; n++) out.push_back(in.get(8));
+      continue;
+    }
+    if (type == 3) throw std::runtime_error("bad block type");
+    uint8_t lengths[320];
+    size_t nlit = 288, ndist = 30;
+    if (type == 1) {
+      std::fill(lengths, lengths + 144, 8);
+      std::fill(lengths + 144, lengths + 256, 9);
+      std::fill(lengths + 256, lengths + 280, 7);
+      std::fill(lengths + 280, lengths + 288, 8);
+      std::fill(lengths + 288, lengths + 318, 5);
+    } else {
+      static const uint8_t order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+      nlit = in.get(5) + 257;
+      ndist = in.get(5) + 1;
+      size_t ncode = in.get(4) + 4;
+      uint8_t codeLengths[19] = {};
+      for (size_t n = 0; n < ncode; n++) codeLengths[order[n]] = in.get(3);
+      Huffman codes(codeLengths, 19);
+      for (size_t n = 0; n < nlit + ndist;) {
+        uint32_t sym = codes.decode(in);
+        if (sym < 16) {
+          lengths[n++] = sym;
+          continue;
+        }
+        uint8_t value = 0;
+        size_t repeat;
+        if (sym == 16) {
+          if (n == 0) throw std::runtime_error("bad length repeat");
+          value = lengths[n - 1];
+          repeat = 3 + in.get(2);
+        } else if (sym == 17) {
+          repeat = 3 + in.get(3);
+        } else {
+          repeat = 11 + in.get(7);
+        }
+        if (n + repeat > nlit + ndist) throw std::runtime_error("bad length repeat");
+        while (repeat--) lengths[n++] = value;
+      }
+    }
+    Huffman lit(lengths, nlit), dist(lengths + nlit, ndist);
+    for (;;) {
+      uint32_t sym = lit.decode(in);
+      if (sym < 256) {
+        out.push_back(sym);
+        continue;
+      }
+      if (sym == 256) break;
+      sym -= 257;
+      if (sym >= 29) throw std::runtime_error("bad length code");
+      size_t len = deflateLengthBase[sym] + in.get(deflateLengthExtra[sym]);
+      uint32_t d = dist.decode(in);
+      if (d >= 30) throw std::runtime_error("bad distance code");
+      size_t distance = deflateDistBase[d] + in.get(deflateDistExtra[d]);
+      if (distance > out.size()) throw std::runtime_error("distance too far back");
+      for (size_t n = 0; n < len; n++) out.push_back(out[out.size() - distance]);
+    }
+  }
+  return out;
+}
+
+struct PngImage {
+  size_t w = 0, h = 0;
+  PngColor color = PngColor::rgb;
+  std::vector<uint8_t> pixels;
+};
+
+// Empty if the file is missing or not in a form savePng writes.
+inline PngImage loadPng(const std::string& name) {
+  std::ifstream in(name, std::ios::binary);
+  std::vector<uint8_t> file((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  auto be32 = [&](size_t at) {
+    return uint32_t(file[at]) << 24 | file[at + 1] << 16 | file[at + 2] << 8 | file[at + 3];
+  };
+  PngImage image;
+  std::vector<uint8_t> compressed;
+  if (file.size() < 8 || memcmp(file.data(), "\x89PNG\r\n\x1A\n", 8)) return {};
+  for (size_t at = 8; at + 12 <= file.size();) {
+    size_t len = be32(at);
+    if (at + 12 + len > file.size()) return {};
+    const uint8_t* chunk = file.data() + at + 8;
+    if (!memcmp(file.data() + at + 4, "IHDR", 4) && len >= 13) {
+      if (chunk[8] != 8 || (chunk[9] != 2 && chunk[9] != 3) || chunk[12]) return {};
+      image.w = be32(at + 8);
+      image.h = be32(at + 12);
+      image.color = PngColor(chunk[9]);
+    } else if (!memcmp(file.data() + at + 4, "IDAT", 4)) {
+      compressed.insert(compressed.end(), chunk, chunk + len);
+    }
+    at += 12 + len;
+  }
+  if (compressed.size() < 6 || !image.w || !image.h) return {};
+  std::vector<uint8_t> raw;
+  try {
+    raw = inflate(std::span(compressed).subspan(2));
+  } catch (const std::runtime_error&) {
+    return {};
+  }
+  size_t bpp = image.color == PngColor::rgb ? 3 : 1, bytes = image.w * bpp;
+  if (raw.size() < image.h * (bytes + 1)) return {};
+  image.pixels.resize(image.h * bytes);
+  for (size_t y = 0; y < image.h; y++) {
+    uint8_t type = raw[y * (bytes + 1)];
+    const uint8_t* src = raw.data() + y * (bytes + 1) + 1;
+    uint8_t* row = image.pixels.data() + y * bytes;
+    const uint8_t* above = y ? row - bytes : nullptr;
+    for (size_t i = 0; i < bytes; i++) {
+      int a = i >= bpp ? row[i - bpp] : 0, b = above ? above[i] : 0, c = i >= bpp && above ? above[i - bpp] : 0;
+      int p = a + b - c, pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+      int predicted = type == 1 ? a : type == 2 ? b : type == 3 ? (a + b) / 2 : type == 4 ? (pa <= pb && pa <= pc ? a : pb <= pc ? b : c) : 0;
+      row[i] = src[i] + predicted;
+    }
+  }
+  return image;
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include "Blit.h"
+#include "Palette.h"
+#include "Shape.h"
+
+// Frame RLE decoding. Each row is a series of (skip, length) pairs followed
+// by length literal pixels; in compression 1 the low bit of length marks a
+// fill run of a single pixel instead. decodeRleAs is specialised on the
+// compression mode, so that test is made once per frame by decodeRle rather
+// than once per run, and on the sink the runs go to:
+//   sink.literal(row, x, pixels, length)
+//   sink.fill(row, x, index, length)
+// Runs arrive in order. Nothing is bounds checked; only frames that passed
+// validateFrame should be decoded.
+
+// Number of frames whose headers lie inside the shape's data; less than the
+// header's count if the frame table is cut short.
+inline size_t framesInShape(std::span<const uint8_t> shape) {
+  if (shape.size() < sizeof(ShpHeader)) return 0;
+  const ShpHeader* h = reinterpret_cast<const ShpHeader*>(shape.data());
+  return std::min<size_t>(h->count, (shape.size() - sizeof(ShpHeader)) / sizeof(FrameHeader));
+}
+
+// Checks everything the decoders take on trust for one frame, which must be
+// below framesInShape: the frame header, row offsets and every row's runs lie
+// inside the shape's data, and no run goes past the frame width. Returns
+// what is wrong, or nullptr if the frame is safe to decode. Frames are
+// checked once, so decodeRle itself never has to. end, if given, receives
+// the offset in the shape just past the frame's last row offset or run byte.
+inline const char* validateFrame(std::span<const uint8_t> shape, size_t frame, size_t* end = nullptr) {
+  const FrameHeader* fh = reinterpret_cast<const FrameHeader*>(shape.data() + sizeof(ShpHeader)) + frame;
+  size_t size = shape.size(), offset = fh->frameOffset & 0x7FFFFFFF;
+  size_t table = offset + offsetof(FrameData, rowOffsets);
+  if (offset > size || size - offset < offsetof(FrameData, rowOffsets)) return "frame header past end of shape";
+  const FrameData* fdata = reinterpret_cast<const FrameData*>(shape.data() + offset);
+  if (fdata->compression > 1) return "unknown compression";
+  if (fdata->height > (size - table) / sizeof(uint32_t)) return "row offsets past end of shape";
+  size_t last = table + fdata->height * sizeof(uint32_t);
+  for (size_t row = 0; row < fdata->height; row++) {
+    size_t at = table + row * sizeof(uint32_t) + fdata->rowOffsets[row];
+    uint32_t x = 0;
+    while (x < fdata->width) {
+      if (at >= size) return "row past end of shape";
+      x += shape[at++];
+      if (x >= fdata->width) break;
+      if (at >= size) return "row past end of shape";
+      uint32_t length = shape[at++];
+      bool fill = false;
+      if (fdata->compression == 1) {
+        fill = length & 1;
+        length >>= 1;
+      }
+      if (length > fdata->width - x) return "run past frame width";
+      if ((fill ? 1 : length) > size - at) return "run past end of shape";
+      at += fill ? 1 : length;
+      x += length;
+    }
+    last = std::max(last, at);
+  }
+  if (end) *end = last;
+  return nullptr;
+}
+
+template <uint32_t Compression, typename Sink>
+inline void decodeRleAs(const FrameData* fdata, Sink& sink) {
+  const uint32_t width = fdata->width;
+  for (uint32_t row = 0; row < fdata->height; row++) {
+    const uint8_t* in = (const uint8_t*)&fdata->rowOffsets[row] + fdata->rowOffsets[row];
+    uint32_t x = 0;
+    while (x < width) {
+      x += *in++;
+      if (x >= width) break;
+      uint32_t length = *in++;
+      if constexpr (Compression == 1) {
+        bool fill = length & 1;
+        length >>= 1;
+        if (fill) {
+          sink.fill(row, x, *in++, length);
+          x += length;
+          continue;
+        }
+      }
+      sink.literal(row, x, in, length);
+      in += length;
+      x += length;
+    }
+  }
+}
+
+template <typename Sink>
+inline void decodeRle(const FrameData* fdata, Sink&& sink) {
+  if (fdata->compression == 1) {
+    decodeRleAs<1>(fdata, sink);
+  } else {
+    decodeRleAs<0>(fdata, sink);
+  }
+}
+
+// Palette indices, stride bytes per row. Pixels the frame skips are left
+// alone. A negative stride writes bottom-up.
+struct IndexedSink {
+  uint8_t* out;
+  ptrdiff_t stride;
+  void literal(uint32_t row, uint32_t x, const uint8_t* src, uint32_t length) {
+    memcpy(out + row * stride + x, src, length);
+  }
+  void fill(uint32_t row, uint32_t x, uint8_t index, uint32_t length) {
+    memset(out + row * stride + x, index, length);
+  }
+};
+
+// 24-bit BGR pixels through a palette LUT. Keyed pixels are left alone, as
+// are the ones the frame skips.
+struct Bgr24Sink {
+  uint8_t* out;
+  ptrdiff_t stride;
+  const uint32_t* lut = paletteLut.data();
+  void literal(uint32_t row, uint32_t x, const uint8_t* src, uint32_t length) {
+    blitLiteral(out + row * stride + x * 3, src, length, lut);
+  }
+  void fill(uint32_t row, uint32_t x, uint8_t index, uint32_t length) {
+    blitFill(out + row * stride + x * 3, lut[index], length);
+  }
+};
+
+// Counts the frame's opaque pixels.
+struct OpaqueSink {
+  size_t count = 0;
+  void literal(uint32_t, uint32_t, const uint8_t* src, uint32_t length) {
+    for (uint32_t n = 0; n < length; n++) {
+      count += paletteKey[src[n]] != transparentIndex;
+    }
+  }
+  void fill(uint32_t, uint32_t, uint8_t index, uint32_t length) {
+    if (paletteKey[index] != transparentIndex) count += length;
+  }
+};
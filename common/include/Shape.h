@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+
+struct [[gnu::packed]] ShpHeader {
+  uint16_t maxX;
+  uint16_t maxY;
+  uint16_t count;
+};
+
+struct [[gnu::packed]] FrameHeader {
+  uint32_t frameOffset; // ignore top bit
+  uint32_t framesize;
+};
+
+struct [[gnu::packed]] FrameData {
+  uint16_t imageId;
+  uint16_t frameId;
+  uint32_t absoluteOffset;
+  uint32_t compression;
+  uint32_t width;
+  uint32_t height;
+  int32_t offx;
+  int32_t offy;
+  uint32_t rowOffsets[1];
+};
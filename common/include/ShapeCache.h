@@ -0,0 +1,180 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <list>
+#include <memory>
+#include <span>
+#include <unordered_map>
+#include <vector>
+#include "FlxArchive.h"
+#include "FrameIndex.h"
+#include "Palette.h"
+#include "Rle.h"
+#include "Shape.h"
+
+// A frame with its RLE already undone: one run per literal or fill span,
+// with the literal pixels (or the single fill pixel) copied into pixels.
+// Keyed pixels are stored as transparentIndex.
+struct DecodedFrame {
+  struct Run {
+    uint32_t row;
+    uint32_t x;
+    uint32_t length;
+    uint32_t offset;
+    bool fill;
+  };
+  std::vector<Run> runs;
+  std::vector<uint8_t> pixels;
+  size_t opaque = 0;
+  size_t bytes() const {
+    return runs.size() * sizeof(Run) + pixels.size();
+  }
+};
+
+// A shape's frames point into the archive; frames that failed validateFrame
+// are null. entries holds the frames' entries in the frame index, if any.
+struct CachedShape {
+  const ShpHeader* header = nullptr;
+  std::vector<const FrameData*> frames;
+  std::vector<const FrameIndexEntry*> entries;
+  std::vector<std::shared_ptr<const DecodedFrame>> decoded;
+  size_t bytes = 0;
+};
+
+// Collects a frame's runs into a DecodedFrame.
+struct DecodedFrameSink {
+  DecodedFrame& df;
+  void literal(uint32_t row, uint32_t x, const uint8_t* src, uint32_t length) {
+    size_t offset = df.pixels.size();
+    df.runs.push_back({row, x, length, uint32_t(offset), false});
+    df.pixels.resize(offset + length);
+    for (size_t n = 0; n < length; n++) {
+      uint8_t index = paletteKey[src[n]];
+      df.opaque += index != transparentIndex;
+      df.pixels[offset + n] = index;
+    }
+  }
+  void fill(uint32_t row, uint32_t x, uint8_t index, uint32_t length) {
+    df.runs.push_back({row, x, length, uint32_t(df.pixels.size()), true});
+    index = paletteKey[index];
+    if (index != transparentIndex) df.opaque += length;
+    df.pixels.push_back(index);
+  }
+};
+
+inline DecodedFrame decodeFrame(const FrameData* fdata) {
+  DecodedFrame df;
+  decodeRle(fdata, DecodedFrameSink{df});
+  return df;
+}
+
+// Parsed shapes keyed by shape id. Frame tables point into the archive
+// mapping and come from the frame index when there is one, which saves
+// validating every frame again. Decoded frames are kept until the total
+// size of the cache goes over budget, at which point the least recently
+// used shapes are dropped.
+struct ShapeCache {
+  ShapeCache(const FlxArchive& archive, size_t budget, const FrameIndex* index = nullptr)
+  : archive(archive)
+  , budget(budget)
+  , index(index)
+  {
+  }
+  CachedShape* get(uint16_t shape) {
+    auto it = slots.find(shape);
+    if (it != slots.end()) {
+      hits++;
+      lru.splice(lru.begin(), lru, it->second.second);
+      return it->second.first.header ? &it->second.first : nullptr;
+    }
+    misses++;
+    CachedShape cs;
+    std::span<const uint8_t> data = archive[shape];
+    if (data.size() >= sizeof(ShpHeader)) {
+      cs.header = reinterpret_cast<const ShpHeader*>(data.data());
+      if (index) {
+        // Validated when the index was built; only broken frames are looked
+        // at again, to say what is wrong with them.
+        size_t count = std::min(index->frameCount(shape), framesInShape(data));
+        for (size_t n = 0; n < count; n++) {
+          const FrameData* fdata = index->frameData(archive, shape, n);
+          const char* error = fdata ? nullptr : validateFrame(data, n);
+          if (error) fprintf(stderr, "shape %u frame %zu: %s\n", shape, n, error);
+          cs.frames.push_back(fdata);
+          cs.entries.push_back(&index->frames(shape)[n]);
+        }
+      } else {
+        size_t count = framesInShape(data);
+        if (count < cs.header->count) fprintf(stderr, "shape %u: frame table cut short at %zu of %u frames\n", shape, count, cs.header->count);
+        const FrameHeader* fhs = reinterpret_cast<const FrameHeader*>(data.data() + sizeof(ShpHeader));
+        for (size_t n = 0; n < count; n++) {
+          const char* error = validateFrame(data, n);
+          if (error) fprintf(stderr, "shape %u frame %zu: %s\n", shape, n, error);
+          cs.frames.push_back(error ? nullptr : reinterpret_cast<const FrameData*>(data.data() + (fhs[n].frameOffset & 0x7FFFFFFF)));
+        }
+      }
+      cs.decoded.resize(cs.frames.size());
+    }
+    cs.bytes = sizeof(CachedShape) + cs.frames.size() * (sizeof(const FrameData*) + sizeof(const FrameIndexEntry*) + sizeof(std::shared_ptr<const DecodedFrame>));
+    lru.push_front(shape);
+    auto& slot = slots.emplace(shape, std::make_pair(std::move(cs), lru.begin())).first->second;
+    used += slot.first.bytes;
+    trim();
+    return slot.first.header ? &slot.first : nullptr;
+  }
+  // Frames with the same pixel content, in whatever shape, are decoded once
+  // and share a DecodedFrame for as long as any shape holding it is cached.
+  // The index's pixel hash finds candidates; their bytes are compared before
+  // one is reused. Each holder still counts its size against the budget.
+  const DecodedFrame& decoded(CachedShape& cs, size_t frame) {
+    auto& df = cs.decoded[frame];
+    if (!df) {
+      const FrameIndexEntry* e = frame < cs.entries.size() ? cs.entries[frame] : nullptr;
+      PixelContent content;
+      std::weak_ptr<const DecodedFrame>* same = nullptr;
+      if (e) {
+        content = pixelContent(cs.frames[frame], *e);
+        auto [begin, end] = shared.equal_range(e->pixels);
+        auto it = std::find_if(begin, end, [&](const auto& s) { return samePixels(s.second.first, content); });
+        if (it != end) {
+          same = &it->second.second;
+          df = same->lock();
+        }
+      }
+      if (df) {
+        sharedDecodes++;
+      } else {
+        df = std::make_shared<const DecodedFrame>(decodeFrame(cs.frames[frame]));
+        if (same) {
+          *same = df;
+        } else if (e) {
+          shared.emplace(e->pixels, std::make_pair(std::move(content), df));
+        }
+      }
+      cs.bytes += df->bytes();
+      used += df->bytes();
+      trim();
+    }
+    return *df;
+  }
+  void trim() {
+    // The front entry is the one just handed out, so it is never evicted.
+    while (used > budget && lru.size() > 1) {
+      auto it = slots.find(lru.back());
+      used -= it->second.first.bytes;
+      slots.erase(it);
+      lru.pop_back();
+      evictions++;
+    }
+  }
+  const FlxArchive& archive;
+  size_t budget;
+  const FrameIndex* index;
+  size_t used = 0;
+  size_t hits = 0, misses = 0, evictions = 0, sharedDecodes = 0;
+  std::list<uint16_t> lru;
+  std::unordered_map<uint16_t, std::pair<CachedShape, std::list<uint16_t>::iterator>> slots;
+  std::unordered_multimap<uint64_t, std::pair<PixelContent, std::weak_ptr<const DecodedFrame>>> shared;
+};
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Skyline rectangle packer. The lower edge of everything placed so far is
+// kept as a list of horizontal segments, and each rectangle goes wherever it
+// sits nearest the top of the page. Works best fed tallest first.
+struct SkylinePacker {
+  struct Segment {
+    int32_t x, y, w;
+  };
+  int32_t width = 0, height = 0;
+  int32_t used = 0;
+  std::vector<Segment> skyline;
+  SkylinePacker(int32_t width, int32_t height)
+  : width(width)
+  , height(height)
+  , skyline{{0, 0, width}}
+  {
+  }
+  // Places a w x h rectangle and returns its corner in x, y, or returns
+  // false if it no longer fits.
+  bool insert(int32_t w, int32_t h, int32_t& x, int32_t& y) {
+    size_t best = skyline.size();
+    int32_t bestY = 0, bestW = 0;
+    for (size_t i = 0; i < skyline.size(); i++) {
+      if (skyline[i].x + w > width) break;
+      int32_t top = 0;
+      for (size_t j = i; j < skyline.size() && skyline[j].x < skyline[i].x + w; j++) {
+        top = std::max(top, skyline[j].y);
+      }
+      if (top + h > height) continue;
+      if (best == skyline.size() || top < bestY || (top == bestY && skyline[i].w < bestW)) {
+        best = i;
+        bestY = top;
+        bestW = skyline[i].w;
+      }
+    }
+    if (best == skyline.size()) return false;
+    x = skyline[best].x;
+    y = bestY;
+    skyline.insert(skyline.begin() + best, {x, y + h, w});
+    // Trim or drop the segments the new one now covers.
+    for (size_t i = best + 1; i < skyline.size();) {
+      Segment& s = skyline[i];
+      int32_t overlap = x + w - s.x;
+      if (overlap <= 0) break;
+      if (overlap < s.w) {
+        s.x += overlap;
+        s.w -= overlap;
+        break;
+      }
+      skyline.erase(skyline.begin() + i);
+    }
+    for (size_t i = 0; i + 1 < skyline.size();) {
+      if (skyline[i].y == skyline[i + 1].y) {
+        skyline[i].w += skyline[i + 1].w;
+        skyline.erase(skyline.begin() + i + 1);
+      } else {
+        i++;
+      }
+    }
+    used = std::max(used, y + h);
+    return true;
+  }
+};
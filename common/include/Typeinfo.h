@@ -0,0 +1,153 @@
+#pragma once
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <span>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+#include <map>
+
+enum typeflags {
+  fixed = 0x00001,
+  solid = 0x00002,
+  sea = 0x00004,
+  land = 0x00008,
+  occluded = 0x00010,
+  bag = 0x00020,
+  damaging = 0x00040,
+  noisy = 0x00080,
+  draw = 0x00100,
+  ignore = 0x00200,
+  roof = 0x00400,
+  transl = 0x00800,
+  editor = 0x01000,
+  selectable = 0x02000,
+  preload = 0x04000,
+  sound = 0x08000,
+  targetable = 0x10000,
+  npc = 0x20000,
+  unk66 = 0x40000,
+  unk67 = 0x80000
+};
+
+inline std::map<size_t, std::string> knownFlags = {
+  { fixed, "fixed" },
+  { solid, "solid" },
+  { sea, "sea" },
+  { land, "land" },
+  { occluded, "occluded" },
+  { bag, "bag" },
+  { damaging, "damaging" },
+  { noisy, "noisy" },
+  { draw, "draw" },
+  { ignore, "ignore" },
+  { roof, "roof" },
+  { transl, "transl" },
+  { editor, "editor" },
+  { selectable, "selectable" },
+  { preload, "preload" },
+  { sound, "sound" },
+  { targetable, "targetable" },
+  { npc, "npc" },
+  { unk66, "unk66" },
+  { unk67, "unk67" },
+};
+
+// World size of one Typeinfo footprint unit. An object's position is the
+// corner of its box nearest the viewer at the bottom, so the box extends
+// towards -x, -y and +z from it.
+inline constexpr int32_t footXY = 64, footZ = 8;
+
+// One type record, assembled from a TypeTable row.
+struct Typeinfo {
+  void print(size_t n) {
+    printf("%4zu %u %u (%u %u %u) (%u %u %u) %u %u (", n, family, equip, x, y, z, animtype, animdata, animSpeed, weight, volume);
+    for (auto& [flag, name] : knownFlags) {
+      if (flags & flag) printf("%s ", name.c_str());
+    }
+    printf(")\n");
+  }
+  uint32_t flags;
+  uint8_t family;
+  uint8_t equip;
+  uint8_t x;
+  uint8_t y;
+  uint8_t z;
+  uint8_t animtype;
+  uint8_t animdata;
+  uint8_t animSpeed;
+  uint8_t weight;
+  uint8_t volume;
+};
+
+// A type flag file (TYPEFLAG.DAT), one 9-byte record per shape, decoded in
+// one pass into a column per field. Lookups by shape are a single indexed
+// load, and queries scan only the column they need.
+struct TypeTable {
+  std::vector<uint32_t> flags;
+  std::vector<uint8_t> family, equip, x, y, z, animtype, animdata, animSpeed, weight, volume;
+  TypeTable() {
+  }
+  explicit TypeTable(std::span<const uint8_t> data) {
+    size_t count = data.size() / 9;
+    flags.resize(count);
+    for (auto* column : {&family, &equip, &x, &y, &z, &animtype, &animdata, &animSpeed, &weight, &volume}) {
+      column->resize(count);
+    }
+    // The first eight bytes of a record hold every field but volume, so one
+    // little-endian load per record and a shift per field decodes it.
+    for (size_t n = 0; n < count; n++) {
+      const uint8_t* p = data.data() + n * 9;
+      uint64_t w;
+      memcpy(&w, p, 8);
+      flags[n] = (w & 0xFFF) | ((w >> 48 & 0xFF) << 12);
+      family[n] = (w >> 12) & 0x1F;
+      equip[n] = (w >> 17) & 0xF;
+      x[n] = (w >> 21) & 0x1F;
+      y[n] = (w >> 26) & 0x1F;
+      z[n] = (w >> 31) & 0x1F;
+      animtype[n] = (w >> 36) & 0xF;
+      animdata[n] = (w >> 40) & 0xF;
+      animSpeed[n] = (w >> 44) & 0xF;
+      if (animtype[n] && !animSpeed[n]) animSpeed[n]++;
+      weight[n] = w >> 56;
+      volume[n] = p[8];
+    }
+  }
+  static TypeTable load(const std::string& name) {
+    std::vector<uint8_t> data;
+    data.resize(std::filesystem::file_size(name));
+    std::ifstream(name).read(reinterpret_cast<char*>(data.data()), data.size());
+    return TypeTable(data);
+  }
+  size_t size() const {
+    return flags.size();
+  }
+  // False for shapes past the end of the table.
+  bool has(size_t shape, uint32_t flag) const {
+    return shape < flags.size() && (flags[shape] & flag);
+  }
+  Typeinfo operator[](size_t shape) const {
+    return {flags[shape], family[shape], equip[shape], x[shape], y[shape], z[shape],
+            animtype[shape], animdata[shape], animSpeed[shape], weight[shape], volume[shape]};
+  }
+  // Shapes that have every flag in mask.
+  std::vector<uint16_t> withFlags(uint32_t mask) const {
+    std::vector<uint16_t> shapes;
+    for (size_t n = 0; n < flags.size(); n++) {
+      if ((flags[n] & mask) == mask) shapes.push_back(n);
+    }
+    return shapes;
+  }
+  std::vector<uint16_t> inFamily(uint8_t f) const {
+    std::vector<uint16_t> shapes;
+    for (size_t n = 0; n < family.size(); n++) {
+      if (family[n] == f) shapes.push_back(n);
+    }
+    return shapes;
+  }
+};
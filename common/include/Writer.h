@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cerrno>
+#include <charconv>
+#include <concepts>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+// Buffered text output. Formatting appends to an in-memory buffer that goes
+// to the file in 64 KB writes, instead of a stdio call per line. Floating
+// point values print like printf's %f.
+struct Writer {
+  static constexpr size_t flushSize = 1 << 16;
+  FILE* file = nullptr;
+  std::string buffer;
+  explicit Writer(const std::string& name)
+  : file(fopen(name.c_str(), "wb"))
+  {
+    if (!file) throw std::system_error(errno, std::generic_category(), name);
+    buffer.reserve(flushSize + 256);
+  }
+  Writer(const Writer&) = delete;
+  Writer& operator=(const Writer&) = delete;
+  ~Writer() {
+    flush();
+    fclose(file);
+  }
+  void flush() {
+    fwrite(buffer.data(), 1, buffer.size(), file);
+    buffer.clear();
+  }
+  Writer& operator<<(std::string_view text) {
+    buffer.append(text);
+    if (buffer.size() >= flushSize) flush();
+    return *this;
+  }
+  Writer& operator<<(char c) {
+    buffer.push_back(c);
+    return *this;
+  }
+  template <std::integral T>
+  Writer& operator<<(T value) {
+    char text[24];
+    return *this << std::string_view(text, std::to_chars(text, text + sizeof(text), value).ptr);
+  }
+  Writer& operator<<(double value) {
+    char text[64];
+    auto result = std::to_chars(text, text + sizeof(text), value, std::chars_format::fixed, 6);
+    if (result.ec != std::errc()) return *this << std::string_view(text, snprintf(text, sizeof(text), "%f", value));
+    return *this << std::string_view(text, result.ptr);
+  }
+};
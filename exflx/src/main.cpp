@@ -1,35 +1,32 @@
-#include <filesystem>
+#include <cstdio>
 #include <fstream>
 #include <span>
-#include <vector>
 #include <cstdint>
+#include "Dedup.h"
+#include "FlxArchive.h"
+#include "Hash.h"
 
-struct Header {
-  char tag[84];
-  uint32_t fileCount;
-  uint32_t one;
-  uint32_t fileSize;
-  uint32_t pad[8];
-};
-
-struct FileEntry {
-  uint32_t offset;
-  uint32_t size;
-};
-
+// Entries with the same content as an earlier one are extracted as hard
+// links to it and listed, followed by a summary.
 int main(int, const char** argv) {
-  std::vector<uint8_t> data;
-  data.resize(std::filesystem::file_size(argv[1]));
-  std::ifstream(argv[1]).read(reinterpret_cast<char*>(data.data()), data.size());
-  Header* header = reinterpret_cast<Header*>(data.data());
-  FileEntry* firstEntry = reinterpret_cast<FileEntry*>(header+1);
-  printf("%u entries\n", header->fileCount);
-  std::span<FileEntry> entries{firstEntry, firstEntry + header->fileCount};
+  FlxArchive archive(argv[1]);
+  printf("%zu entries\n", archive.size());
+  DedupFiles dedup;
   size_t index = 0;
-  for (auto& entry : entries) {
+  for (size_t n = 0; n < archive.size(); n++) {
+    const FileEntry& entry = archive.entries()[n];
     if (entry.offset == 0) continue;
-    const char* filedata = reinterpret_cast<const char*>(data.data() + entry.offset);
-    std::ofstream(argv[1] + std::string(".") + std::to_string(index)).write(filedata, entry.size);
-    index++;
+    std::string name = argv[1] + std::string(".") + std::to_string(index++);
+    std::span<const uint8_t> data = archive[n];
+    if (data.size() != entry.size) {
+      fprintf(stderr, "%s: entry %zu at %u, %u bytes, lies outside the archive\n", name.c_str(), n, entry.offset, entry.size);
+      continue;
+    }
+    if (const std::string* same = dedup.link(hash64(data), name, {data})) {
+      printf("%s: same as %s\n", name.c_str(), same->c_str());
+    } else {
+      std::ofstream(name).write(reinterpret_cast<const char*>(data.data()), data.size());
+    }
   }
+  dedup.report("entries");
 }
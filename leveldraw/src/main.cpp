@@ -1,318 +1,1148 @@
+#include <algorithm>
+#include <atomic>
+#include <climits>
 #include <filesystem>
+#include <memory>
 #include <fstream>
 #include <span>
 #include <vector>
+#include <array>
+#include <cstring>
 #include <cstdint>
+#include <tuple>
+#include <utility>
 #include <unordered_map>
+#include "Blit.h"
+#include "FlxArchive.h"
+#include "FrameIndex.h"
+#include "Hash.h"
+#include "Level.h"
+#include "LevelIndex.h"
+#include "Palette.h"
+#include "Parallel.h"
+#include "Png.h"
+#include "Typeinfo.h"
+#include "ShapeCache.h"
 
-struct [[gnu::packed]] ShpHeader {
-  uint16_t maxX;
-  uint16_t maxY;
-  uint16_t count;
+static std::array<uint8_t, 54> bmpheader = {
+  0x42, 0x4d, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x36, 0x00, 0x00, 0x00, 0x28, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x01, 0x00, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00, 0x30, 0x00, 0x00, 0x00, 0x23, 0x2e, 0x00, 0x00, 0x23, 0x2e, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
 };
 
-struct [[gnu::packed]] FrameHeader {
-  uint32_t frameOffset; // ignore top bit
-  uint32_t framesize;
+// Half-open pixel rectangle.
+struct Clip {
+  int32_t x0, y0, x1, y1;
 };
 
-struct [[gnu::packed]] FrameData {
-  uint16_t imageId;
-  uint16_t frameId;
-  uint32_t absoluteOffset;
-  uint32_t compression;
-  uint32_t width;
-  uint32_t height;
-  int32_t offx;
-  int32_t offy;
-  uint32_t rowOffsets[1];
-};
+// Bitmaps and tiled renders share this tile size, so a render tile always
+// writes into exactly one bitmap tile.
+static constexpr int32_t tileSize = 256;
 
-struct [[gnu::packed]] Entry {
-  uint16_t x;
-  uint16_t y;
-  uint8_t z;
-  uint16_t type;
-  uint8_t frame;
-  uint16_t flags;
-  uint16_t count;
-  uint8_t npcIndex;
-  uint8_t mapIndex;
-  uint16_t nextObj;
+// Framebuffer kept as tileSize x tileSize tiles, top row first, of either
+// 24-bit BGR pixels or 8-bit palette indices with transparentIndex as the
+// background. A tile is allocated the first time something is written to it,
+// so the empty corners around a diamond-shaped level cost no memory. Save and
+// SavePng stream the rows out, treating tiles that were never touched as
+// black; indexed pixels are only expanded to colours there, and not at all
+// for a paletted PNG. Copying a bitmap shares its tiles; unshare gives one
+// tile a private copy before it is drawn into.
+struct Bitmap {
+  std::vector<std::shared_ptr<uint8_t[]>> tiles;
+  size_t tilesx = 0;
+  size_t w = 0, h = 0;
+  size_t bpp = 3;
+  Bitmap() {
+  }
+  Bitmap(size_t w, size_t h, bool indexed = false)
+  : tilesx((w + tileSize - 1) / tileSize)
+  , w(w)
+  , h(h)
+  , bpp(indexed ? 1 : 3)
+  {
+    tiles.resize(tilesx * ((h + tileSize - 1) / tileSize));
+  }
+  size_t tileBytes() const {
+    return tileSize * tileSize * bpp;
+  }
+  uint8_t* pixel(size_t x, size_t y) {
+    auto& tile = tiles[(y / tileSize) * tilesx + x / tileSize];
+    if (!tile) tile = std::make_shared<uint8_t[]>(tileBytes());
+    return tile.get() + ((y % tileSize) * tileSize + x % tileSize) * bpp;
+  }
+  void set(size_t x, size_t y, uint8_t index) {
+    uint8_t* p = pixel(x, y);
+    if (bpp == 1) {
+      *p = index;
+    } else {
+      uint32_t color = paletteLut[index];
+      p[0] = color;
+      p[1] = color >> 8;
+      p[2] = color >> 16;
+    }
+  }
+  // The packed BGR colour at (x, y); does not allocate.
+  uint32_t color(size_t x, size_t y) const {
+    auto& tile = tiles[(y / tileSize) * tilesx + x / tileSize];
+    if (!tile) return 0;
+    const uint8_t* p = tile.get() + ((y % tileSize) * tileSize + x % tileSize) * bpp;
+    return bpp == 1 ? paletteLut[*p] : p[0] | (p[1] << 8) | (p[2] << 16);
+  }
+  // Draws one RLE run starting at (x, y), clipped to clip, which must lie
+  // inside the bitmap. A fill run reads its single pixel from src, a
+  // literal run reads length pixels.
+  void span(int32_t x, int32_t y, const uint8_t* src, size_t length, bool fill, const Clip& clip) {
+    if (y < clip.y0 || y >= clip.y1) return;
+    if (x < clip.x0) {
+      if (size_t(clip.x0 - x) >= length) return;
+      if (!fill) src += clip.x0 - x;
+      length -= clip.x0 - x;
+      x = clip.x0;
+    }
+    if (x >= clip.x1) return;
+    if (length > size_t(clip.x1 - x)) length = clip.x1 - x;
+    while (length) {
+      size_t n = std::min<size_t>(length, tileSize - x % tileSize);
+      uint8_t* p = pixel(x, y);
+      if (bpp == 1) {
+        fill ? blitFillIndexed(p, *src, n) : blitLiteralIndexed(p, src, n);
+      } else {
+        fill ? blitFill(p, paletteLut[*src], n) : blitLiteral(p, src, n, paletteLut.data());
+      }
+      if (!fill) src += n;
+      x += n;
+      length -= n;
+    }
+  }
+  void unshare(size_t t) {
+    if (!tiles[t] || tiles[t].use_count() == 1) return;
+    auto copy = std::make_shared<uint8_t[]>(tileBytes());
+    memcpy(copy.get(), tiles[t].get(), tileBytes());
+    tiles[t] = std::move(copy);
+  }
+  // Sets clip back to black, or to transparentIndex when indexed; both are 0.
+  void clear(const Clip& clip) {
+    for (int32_t y = clip.y0; y < clip.y1; y++) {
+      for (int32_t x = clip.x0; x < clip.x1;) {
+        int32_t n = std::min(clip.x1 - x, tileSize - x % tileSize);
+        auto& tile = tiles[(y / tileSize) * tilesx + x / tileSize];
+        if (tile) memset(tile.get() + ((y % tileSize) * tileSize + x % tileSize) * bpp, 0, n * bpp);
+        x += n;
+      }
+    }
+  }
+  Clip bounds() const {
+    return {0, 0, int32_t(w), int32_t(h)};
+  }
+  size_t allocatedBytes() const {
+    return std::count_if(tiles.begin(), tiles.end(), [](auto& t) { return t != nullptr; }) * tileBytes();
+  }
+  // Hands tile t over as RGB pixels and frees it. Empty if nothing but black
+  // was drawn there.
+  std::vector<uint8_t> takeTile(size_t t) {
+    std::shared_ptr<uint8_t[]> tile = std::move(tiles[t]);
+    std::vector<uint8_t> out;
+    if (!tile) return out;
+    out.resize(tileSize * tileSize * 3);
+    uint32_t any = 0;
+    for (size_t i = 0; i < tileSize * tileSize; i++) {
+      const uint8_t* p = tile.get() + i * bpp;
+      uint32_t color = bpp == 1 ? paletteLut[*p] : p[0] | (p[1] << 8) | (p[2] << 16);
+      out[i * 3] = color >> 16;
+      out[i * 3 + 1] = color >> 8;
+      out[i * 3 + 2] = color;
+      any |= color;
+    }
+    if (!any) out.clear();
+    return out;
+  }
+  // Copies row y out as 24-bit pixels in BGR order (BMP) or RGB order (PNG).
+  void row24(size_t y, uint8_t* out, bool rgb) const {
+    size_t b = rgb ? 2 : 0, r = rgb ? 0 : 2;
+    for (size_t tx = 0; tx < tilesx; tx++) {
+      auto& tile = tiles[(y / tileSize) * tilesx + tx];
+      size_t n = std::min<size_t>(tileSize, w - tx * tileSize);
+      if (!tile) {
+        memset(out, 0, n * 3);
+      } else if (bpp == 1) {
+        const uint8_t* p = tile.get() + (y % tileSize) * tileSize;
+        for (size_t i = 0; i < n; i++) {
+          uint32_t color = paletteLut[p[i]];
+          out[i * 3 + b] = color;
+          out[i * 3 + 1] = color >> 8;
+          out[i * 3 + r] = color >> 16;
+        }
+      } else {
+        const uint8_t* p = tile.get() + (y % tileSize) * tileSize * 3;
+        for (size_t i = 0; i < n * 3; i += 3) {
+          out[i + b] = p[i];
+          out[i + 1] = p[i + 1];
+          out[i + r] = p[i + 2];
+        }
+      }
+      out += n * 3;
+    }
+  }
+  void rowIndexed(size_t y, uint8_t* out) const {
+    for (size_t tx = 0; tx < tilesx; tx++) {
+      auto& tile = tiles[(y / tileSize) * tilesx + tx];
+      size_t n = std::min<size_t>(tileSize, w - tx * tileSize);
+      if (tile) {
+        memcpy(out, tile.get() + (y % tileSize) * tileSize, n);
+      } else {
+        memset(out, transparentIndex, n);
+      }
+      out += n;
+    }
+  }
+  // Shrinks the image by an integer factor. Colour pixels average their
+  // factor x factor block; indexed ones keep its top left pixel.
+  Bitmap downscaled(size_t factor) const {
+    Bitmap out((w + factor - 1) / factor, (h + factor - 1) / factor, bpp == 1);
+    for (size_t y = 0; y < out.h; y++) {
+      for (size_t x = 0; x < out.w; x++) {
+        if (bpp == 1) {
+          auto& tile = tiles[(y * factor / tileSize) * tilesx + x * factor / tileSize];
+          if (!tile) continue;
+          uint8_t index = tile[((y * factor % tileSize) * tileSize + x * factor % tileSize)];
+          if (index != transparentIndex) *out.pixel(x, y) = index;
+          continue;
+        }
+        uint32_t sum[3] = {}, count = 0;
+        for (size_t sy = y * factor; sy < std::min(h, (y + 1) * factor); sy++) {
+          for (size_t sx = x * factor; sx < std::min(w, (x + 1) * factor); sx++) {
+            uint32_t c = color(sx, sy);
+            sum[0] += c & 0xFF;
+            sum[1] += (c >> 8) & 0xFF;
+            sum[2] += c >> 16;
+            count++;
+          }
+        }
+        if (!(sum[0] | sum[1] | sum[2])) continue;
+        uint8_t* p = out.pixel(x, y);
+        for (size_t c = 0; c < 3; c++) p[c] = (sum[c] + count / 2) / count;
+      }
+    }
+    return out;
+  }
+  // Both return false if the file could not be written in full.
+  bool Save(const std::string& name) {
+    std::array<uint8_t, 54> header = bmpheader;
+    size_t rowstride = w * 3;
+    while (rowstride & 0x3) rowstride++;
+    uint32_t imageByteCount = rowstride * h;
+    uint32_t fileSize = imageByteCount + header.size();
+    for (size_t n = 0; n < 4; n++) {
+      header[2 + n] = (fileSize >> (8 * n)) & 0xFF;
+      header[18 + n] = (w >> (8 * n)) & 0xFF;
+      header[22 + n] = (h >> (8 * n)) & 0xFF;
+      header[34 + n] = (imageByteCount >> (8 * n)) & 0xFF;
+    }
+    std::vector<uint8_t> row(rowstride);
+    std::ofstream out(name, std::ios::binary);
+    out.write((const char*)header.data(), header.size());
+    for (size_t y = h; y-- > 0;) {
+      row24(y, row.data(), false);
+      out.write((const char*)row.data(), row.size());
+    }
+    out.close();
+    return !out.fail();
+  }
+  bool SavePng(const std::string& name, size_t threads) {
+    if (bpp == 1) {
+      return savePng(name, w, h, PngColor::indexed, [this](size_t y, uint8_t* out) { rowIndexed(y, out); }, threads);
+    } else {
+      return savePng(name, w, h, PngColor::rgb, [this](size_t y, uint8_t* out) { row24(y, out, true); }, threads);
+    }
+  }
 };
 
-struct [[gnu::packed]] GlobEntry {
-  uint8_t x;
-  uint8_t y;
-  uint8_t z;
-  uint16_t shapeindex;
-  uint8_t frame;
+// A per-pixel buffer laid out in the same tiles as Bitmap, such as the depth
+// buffer or the coverage mask. A tile is allocated, zeroed, the first time
+// at() touches it, from whichever thread gets there first; find() reads
+// without allocating and gives null for tiles nobody touched.
+template <typename T>
+struct TiledBuffer {
+  std::unique_ptr<std::atomic<T*>[]> tiles;
+  size_t tilesx = 0, count = 0;
+  TiledBuffer() {
+  }
+  TiledBuffer(size_t w, size_t h)
+  : tilesx((w + tileSize - 1) / tileSize)
+  , count(tilesx * ((h + tileSize - 1) / tileSize))
+  {
+    tiles.reset(new std::atomic<T*>[count]());
+  }
+  TiledBuffer(TiledBuffer&& rhs)
+  : tiles(std::move(rhs.tiles))
+  , tilesx(std::exchange(rhs.tilesx, 0))
+  , count(std::exchange(rhs.count, 0))
+  {
+  }
+  TiledBuffer& operator=(TiledBuffer&& rhs) {
+    std::swap(tiles, rhs.tiles);
+    std::swap(tilesx, rhs.tilesx);
+    std::swap(count, rhs.count);
+    return *this;
+  }
+  ~TiledBuffer() {
+    for (size_t t = 0; t < count; t++) delete[] tiles[t].load();
+  }
+  T* tile(size_t t) {
+    T* p = tiles[t].load(std::memory_order_acquire);
+    if (p) return p;
+    T* fresh = new T[tileSize * tileSize]();
+    if (tiles[t].compare_exchange_strong(p, fresh, std::memory_order_acq_rel)) return fresh;
+    delete[] fresh;
+    return p;
+  }
+  T* at(size_t x, size_t y) {
+    return tile((y / tileSize) * tilesx + x / tileSize) + (y % tileSize) * tileSize + x % tileSize;
+  }
+  const T* find(size_t x, size_t y) const {
+    const T* p = tiles[(y / tileSize) * tilesx + x / tileSize].load(std::memory_order_acquire);
+    return p ? p + (y % tileSize) * tileSize + x % tileSize : nullptr;
+  }
+  size_t allocatedBytes() const {
+    size_t n = 0;
+    for (size_t t = 0; t < count; t++) n += tiles[t].load() != nullptr;
+    return n * tileSize * tileSize * sizeof(T);
+  }
 };
 
-struct Color {
-  uint8_t r, g, b;
-};
+FlxArchive shapeflx, globflx;
+// Set when any output file could not be written; leveldraw then exits with 1.
+std::atomic<bool> writeFailed{false};
+TypeTable types;
 
-Color palette[256] = {
-  { 0x00, 0x00, 0x00 }, { 0x3f, 0x3f, 0x2f }, { 0x3e, 0x3c, 0x08 }, { 0x3f, 0x32, 0x07 },
-  { 0x3f, 0x29, 0x05 }, { 0x3f, 0x1f, 0x03 }, { 0x3f, 0x16, 0x02 }, { 0x3f, 0x0c, 0x00 },
-  { 0x00, 0x00, 0x00 }, { 0x3f, 0x3f, 0x11 }, { 0x3f, 0x15, 0x14 }, { 0x13, 0x29, 0x14 },
-  { 0x00, 0x1d, 0x2f }, { 0x3f, 0x3f, 0x33 }, { 0x3f, 0x3f, 0x32 }, { 0x3f, 0x3f, 0x35 },
-  { 0x3f, 0x3f, 0x3f }, { 0x3a, 0x3a, 0x3a }, { 0x35, 0x35, 0x35 }, { 0x30, 0x30, 0x30 },
-  { 0x2b, 0x2b, 0x2b }, { 0x26, 0x26, 0x26 }, { 0x22, 0x22, 0x22 }, { 0x1d, 0x1d, 0x1d },
-  { 0x19, 0x19, 0x19 }, { 0x16, 0x16, 0x16 }, { 0x12, 0x12, 0x12 }, { 0x0e, 0x0e, 0x0e },
-  { 0x0b, 0x0b, 0x0b }, { 0x07, 0x07, 0x07 }, { 0x03, 0x03, 0x03 }, { 0x00, 0x00, 0x00 },
-  { 0x35, 0x1b, 0x11 }, { 0x2e, 0x19, 0x11 }, { 0x27, 0x17, 0x11 }, { 0x21, 0x15, 0x12 },
-  { 0x1a, 0x13, 0x12 }, { 0x13, 0x10, 0x13 }, { 0x0d, 0x0e, 0x13 }, { 0x06, 0x0c, 0x13 },
-  { 0x36, 0x2d, 0x13 }, { 0x31, 0x29, 0x13 }, { 0x2d, 0x24, 0x14 }, { 0x28, 0x20, 0x15 },
-  { 0x23, 0x1c, 0x15 }, { 0x1f, 0x18, 0x16 }, { 0x1a, 0x14, 0x17 }, { 0x15, 0x0f, 0x17 },
-  { 0x36, 0x36, 0x3a }, { 0x31, 0x32, 0x37 }, { 0x2d, 0x2f, 0x33 }, { 0x29, 0x2b, 0x30 },
-  { 0x24, 0x27, 0x2d }, { 0x20, 0x23, 0x29 }, { 0x1b, 0x20, 0x26 }, { 0x17, 0x1c, 0x23 },
-  { 0x13, 0x18, 0x1f }, { 0x10, 0x15, 0x1b }, { 0x0d, 0x11, 0x16 }, { 0x0b, 0x0e, 0x12 },
-  { 0x08, 0x0b, 0x0e }, { 0x05, 0x07, 0x09 }, { 0x03, 0x04, 0x05 }, { 0x3e, 0x3c, 0x08 },
-  { 0x00, 0x18, 0x37 }, { 0x00, 0x0c, 0x1c }, { 0x3e, 0x38, 0x08 }, { 0x22, 0x08, 0x02 },
-  { 0x00, 0x2d, 0x03 }, { 0x00, 0x1b, 0x02 }, { 0x3f, 0x35, 0x07 }, { 0x3f, 0x31, 0x06 },
-  { 0x2d, 0x2c, 0x22 }, { 0x28, 0x27, 0x1d }, { 0x23, 0x22, 0x18 }, { 0x1d, 0x1d, 0x12 },
-  { 0x17, 0x17, 0x0f }, { 0x11, 0x11, 0x0b }, { 0x0a, 0x0a, 0x07 }, { 0x05, 0x05, 0x03 },
-  { 0x36, 0x36, 0x36 }, { 0x35, 0x32, 0x32 }, { 0x32, 0x2e, 0x2e }, { 0x2e, 0x2a, 0x2a },
-  { 0x2a, 0x26, 0x26 }, { 0x27, 0x22, 0x22 }, { 0x23, 0x1e, 0x1e }, { 0x1f, 0x1a, 0x1a },
-  { 0x1d, 0x17, 0x17 }, { 0x1c, 0x14, 0x14 }, { 0x1a, 0x11, 0x11 }, { 0x18, 0x0e, 0x0e },
-  { 0x13, 0x0a, 0x0a }, { 0x0e, 0x07, 0x07 }, { 0x09, 0x04, 0x04 }, { 0x3f, 0x2d, 0x06 },
-  { 0x3f, 0x3f, 0x3a }, { 0x3f, 0x3b, 0x32 }, { 0x3f, 0x2a, 0x05 }, { 0x3f, 0x26, 0x04 },
-  { 0x3f, 0x2f, 0x19 }, { 0x3f, 0x2b, 0x11 }, { 0x3f, 0x27, 0x08 }, { 0x3f, 0x22, 0x04 },
-  { 0x38, 0x1e, 0x00 }, { 0x32, 0x19, 0x00 }, { 0x2b, 0x15, 0x00 }, { 0x24, 0x10, 0x00 },
-  { 0x1e, 0x0b, 0x00 }, { 0x17, 0x06, 0x00 }, { 0x10, 0x01, 0x00 }, { 0x0a, 0x00, 0x00 },
-  { 0x36, 0x2f, 0x2c }, { 0x33, 0x2b, 0x28 }, { 0x31, 0x27, 0x24 }, { 0x2e, 0x23, 0x20 },
-  { 0x2b, 0x1f, 0x1c }, { 0x29, 0x1c, 0x19 }, { 0x24, 0x19, 0x17 }, { 0x1f, 0x16, 0x16 },
-  { 0x1b, 0x14, 0x15 }, { 0x16, 0x11, 0x13 }, { 0x11, 0x0f, 0x12 }, { 0x0d, 0x0c, 0x11 },
-  { 0x0a, 0x0a, 0x0d }, { 0x07, 0x07, 0x0a }, { 0x04, 0x04, 0x06 }, { 0x01, 0x02, 0x03 },
-  { 0x35, 0x3b, 0x36 }, { 0x2e, 0x36, 0x31 }, { 0x26, 0x30, 0x2c }, { 0x1f, 0x2a, 0x27 },
-  { 0x17, 0x24, 0x22 }, { 0x10, 0x1b, 0x1a }, { 0x08, 0x11, 0x12 }, { 0x01, 0x07, 0x09 },
-  { 0x3f, 0x32, 0x2b }, { 0x3a, 0x2b, 0x25 }, { 0x35, 0x24, 0x20 }, { 0x2f, 0x1d, 0x1a },
-  { 0x2a, 0x16, 0x15 }, { 0x24, 0x10, 0x10 }, { 0x1c, 0x0a, 0x0c }, { 0x16, 0x04, 0x07 },
-  { 0x37, 0x34, 0x2a }, { 0x32, 0x31, 0x28 }, { 0x2d, 0x2e, 0x25 }, { 0x28, 0x2b, 0x23 },
-  { 0x22, 0x28, 0x21 }, { 0x1d, 0x25, 0x1f }, { 0x18, 0x22, 0x1d }, { 0x13, 0x1f, 0x1a },
-  { 0x11, 0x1b, 0x18 }, { 0x0f, 0x18, 0x15 }, { 0x0c, 0x14, 0x13 }, { 0x0a, 0x11, 0x10 },
-  { 0x07, 0x0d, 0x0d }, { 0x05, 0x0a, 0x0b }, { 0x03, 0x06, 0x08 }, { 0x00, 0x03, 0x05 },
-  { 0x3f, 0x1e, 0x03 }, { 0x3f, 0x37, 0x2a }, { 0x3f, 0x34, 0x25 }, { 0x3f, 0x32, 0x20 },
-  { 0x36, 0x2c, 0x20 }, { 0x2c, 0x27, 0x1f }, { 0x23, 0x21, 0x1e }, { 0x19, 0x1c, 0x1e },
-  { 0x10, 0x16, 0x1d }, { 0x06, 0x11, 0x1d }, { 0x05, 0x0f, 0x19 }, { 0x04, 0x0c, 0x15 },
-  { 0x03, 0x0a, 0x11 }, { 0x02, 0x07, 0x0d }, { 0x01, 0x05, 0x09 }, { 0x3f, 0x1b, 0x03 },
-  { 0x3d, 0x37, 0x33 }, { 0x3a, 0x35, 0x2f }, { 0x37, 0x32, 0x2a }, { 0x33, 0x2f, 0x25 },
-  { 0x30, 0x2c, 0x20 }, { 0x2c, 0x29, 0x1b }, { 0x29, 0x25, 0x18 }, { 0x26, 0x22, 0x16 },
-  { 0x23, 0x1e, 0x13 }, { 0x1f, 0x1a, 0x10 }, { 0x1a, 0x16, 0x0e }, { 0x16, 0x12, 0x0b },
-  { 0x12, 0x0e, 0x08 }, { 0x0d, 0x0a, 0x05 }, { 0x09, 0x06, 0x02 }, { 0x04, 0x01, 0x00 },
-  { 0x3f, 0x39, 0x2e }, { 0x3c, 0x33, 0x29 }, { 0x38, 0x2d, 0x24 }, { 0x34, 0x26, 0x1e },
-  { 0x30, 0x20, 0x19 }, { 0x2c, 0x19, 0x14 }, { 0x28, 0x13, 0x0e }, { 0x24, 0x0d, 0x09 },
-  { 0x21, 0x06, 0x03 }, { 0x1d, 0x05, 0x03 }, { 0x19, 0x04, 0x02 }, { 0x15, 0x04, 0x02 },
-  { 0x11, 0x03, 0x02 }, { 0x0d, 0x02, 0x01 }, { 0x09, 0x01, 0x01 }, { 0x06, 0x01, 0x01 },
-  { 0x3f, 0x36, 0x2c }, { 0x3c, 0x31, 0x28 }, { 0x39, 0x2d, 0x23 }, { 0x36, 0x29, 0x1f },
-  { 0x33, 0x24, 0x1b }, { 0x2f, 0x20, 0x16 }, { 0x2c, 0x1b, 0x12 }, { 0x2a, 0x18, 0x11 },
-  { 0x28, 0x16, 0x10 }, { 0x26, 0x13, 0x0f }, { 0x24, 0x10, 0x0d }, { 0x22, 0x0d, 0x0c },
-  { 0x1a, 0x0a, 0x0a }, { 0x11, 0x08, 0x08 }, { 0x08, 0x05, 0x06 }, { 0x3f, 0x17, 0x02 },
-  { 0x3f, 0x33, 0x2f }, { 0x3f, 0x30, 0x2c }, { 0x3f, 0x2d, 0x29 }, { 0x3e, 0x2a, 0x26 },
-  { 0x3e, 0x27, 0x23 }, { 0x3d, 0x24, 0x20 }, { 0x3d, 0x20, 0x1e }, { 0x3d, 0x1d, 0x1b },
-  { 0x3c, 0x1a, 0x18 }, { 0x3c, 0x17, 0x15 }, { 0x3b, 0x14, 0x12 }, { 0x3b, 0x11, 0x0f },
-  { 0x3b, 0x0e, 0x0c }, { 0x3a, 0x0b, 0x0a }, { 0x3a, 0x07, 0x07 }, { 0x39, 0x04, 0x04 },
-  { 0x39, 0x02, 0x02 }, { 0x35, 0x02, 0x02 }, { 0x31, 0x01, 0x01 }, { 0x2e, 0x01, 0x01 },
-  { 0x2a, 0x01, 0x01 }, { 0x26, 0x01, 0x01 }, { 0x22, 0x01, 0x01 }, { 0x1e, 0x01, 0x01 },
-  { 0x1b, 0x01, 0x01 }, { 0x17, 0x01, 0x01 }, { 0x13, 0x01, 0x01 }, { 0x3f, 0x13, 0x01 },
-  { 0x3f, 0x10, 0x01 }, { 0x08, 0x00, 0x00 }, { 0x3f, 0x0c, 0x00 }, { 0x0c, 0x2e, 0x2b },
+struct Options {
+  bool tiled = false;
+  bool depth = false;
+  bool compare = false;
+  bool cull = false;
+  bool png = false;
+  bool indexed = false;
+  bool viewport = false;
+  bool regional = false;
+  std::array<int32_t, 4> view;
+  std::array<int32_t, 4> region;
+  size_t scale = 1;
+  bool pyramid = false;
+  size_t frames = 0;
+  bool sheet = false;
 };
 
-static std::array<uint8_t, 54> bmpheader = {
-  0x42, 0x4d, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x36, 0x00, 0x00, 0x00, 0x28, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x01, 0x00, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00, 0x30, 0x00, 0x00, 0x00, 0x23, 0x2e, 0x00, 0x00, 0x23, 0x2e, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+// A tileSize x tileSize RGB image, or empty for an all-black one.
+using Tile = std::vector<uint8_t>;
+
+struct [[gnu::packed]] PyramidHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t maxZoom;
 };
 
-struct Bitmap {
-  std::vector<uint8_t> buffer;
-  size_t rowstride;
-  size_t w, h;
-  Bitmap() {
-  }
-  Bitmap(size_t w, size_t h)
-  : buffer{bmpheader.begin(), bmpheader.end()}
-  , w(w)
-  , h(h)
+// What a tile pyramid was built from: a hash per tile of every zoom level,
+// covering everything drawn into it, and whether a file was written for it.
+// Kept as <level>.tiles/manifest so the next run only redraws tiles whose
+// hash changed. Zoom level z is 2^z tiles square and the last one holds the
+// full-size render; a blank tile hashes to 0.
+struct TilePyramid {
+  static constexpr uint32_t version = 1;
+  size_t maxZoom = 0;
+  std::vector<std::vector<uint64_t>> hashes;
+  std::vector<std::vector<uint8_t>> written;
+  explicit TilePyramid(size_t maxZoom = 0)
+  : maxZoom(maxZoom)
   {
-    rowstride = w * 3;
-    while (rowstride & 0x3) rowstride++;
-    uint32_t imageByteCount = rowstride * h;
-    buffer.resize(imageByteCount + bmpheader.size());
-    buffer[18] = w & 0xFF;
-    buffer[19] = (w >> 8) & 0xFF;
-    buffer[22] = h & 0xFF;
-    buffer[23] = (h >> 8) & 0xFF;
-    buffer[2] = buffer.size() & 0xFF;
-    buffer[3] = (buffer.size() >> 8) & 0xFF;
-    buffer[4] = (buffer.size() >> 16) & 0xFF;
-    buffer[5] = (buffer.size() >> 24) & 0xFF;
-    buffer[34] = ((imageByteCount)) & 0xFF;
-    buffer[35] = ((imageByteCount) >> 8) & 0xFF;
-    buffer[36] = ((imageByteCount) >> 16) & 0xFF;
-    buffer[37] = ((imageByteCount) >> 24) & 0xFF;
-  }
-  void put(size_t x, size_t y, Color color) {
-    uint8_t* p = buffer.data() + sizeof(bmpheader) + rowstride * (h - y - 1) + x * 3;
-    p[0] = color.b * 4;
-    p[1] = color.g * 4;
-    p[2] = color.r * 4;
-  }
-  void Save(const std::string& name) {
-    std::ofstream(name).write((const char*)buffer.data(), buffer.size());
-  }
-} _b;
+    for (size_t z = 0; z <= maxZoom; z++) {
+      hashes.emplace_back(size_t(1) << (2 * z));
+      written.emplace_back(size_t(1) << (2 * z));
+    }
+  }
+  void save(const std::string& name) const {
+    PyramidHeader header{{'C', 'N', 'R', 'P'}, version, uint32_t(maxZoom)};
+    std::ofstream out(name, std::ios::binary);
+    out.write((const char*)&header, sizeof(header));
+    for (size_t z = 0; z <= maxZoom; z++) {
+      out.write((const char*)hashes[z].data(), hashes[z].size() * sizeof(uint64_t));
+      out.write((const char*)written[z].data(), written[z].size());
+    }
+  }
+  // False if the file is missing or malformed.
+  bool load(const std::string& name) {
+    std::ifstream in(name, std::ios::binary);
+    PyramidHeader header;
+    if (!in.read((char*)&header, sizeof(header))) return false;
+    if (memcmp(header.magic, "CNRP", 4) || header.version != version || header.maxZoom > 16) return false;
+    *this = TilePyramid(header.maxZoom);
+    for (size_t z = 0; z <= maxZoom; z++) {
+      in.read((char*)hashes[z].data(), hashes[z].size() * sizeof(uint64_t));
+      in.read((char*)written[z].data(), written[z].size());
+    }
+    return bool(in);
+  }
+};
 
-static size_t deltax = 0, deltay = 0, imagewidth = 0, imageheight = 0;
-bool draw = false;
-static size_t maxx = 0, maxy = 0, minx = 2147483647, miny = 2147483647;
-void putcolor(uint32_t x, uint32_t y, Color color) {
-  if (draw) {
-    if (color.r == 0 && color.g == 0 && color.b == 0) return;
-    _b.put(x, y, color);
-  }
-  if (x < minx) minx = x;
-  if (x > maxx) maxx = x;
-  if (y < miny) miny = y;
-  if (y > maxy) maxy = y;
+static constexpr int32_t S = 2;
+static constexpr uint32_t drawY = 32768;
+uint32_t screenX(uint32_t dx, uint32_t dy, const FrameData* fdata) {
+  return (int(dx) - int(dy)) / S - fdata->offx + drawY;
+}
+uint32_t screenY(uint32_t dx, uint32_t dy, uint32_t dz, const FrameData* fdata) {
+  return (dx + dy) / (S*2) - dz - fdata->offy + drawY;
 }
 
-void drawShape(uint16_t shape, uint16_t frame, uint32_t dx, uint32_t dy, uint32_t dz) {
-  switch(shape) {
-  case 1592:
-  case 1593:
-  case 1594:
-  case 1608:
-  case 1609:
-    return;
-  }
-  shape--;
-  std::vector<uint8_t> data;
-  try {
-    data.resize(std::filesystem::file_size("shapes.flx." + std::to_string(shape)));
-    std::ifstream("shapes.flx." + std::to_string(shape)).read(reinterpret_cast<char*>(data.data()), data.size());
-  } catch (...) {
-    printf("Cannot draw %s\n", std::to_string(shape).c_str());
-    return;
-  }
-  ShpHeader* h = reinterpret_cast<ShpHeader*>(data.data());
-  std::span<FrameHeader> fhs{reinterpret_cast<FrameHeader*>(data.data() + sizeof(ShpHeader)),
-                            reinterpret_cast<FrameHeader*>(data.data() + sizeof(ShpHeader)) + h->count};
-  std::vector<std::span<const uint8_t>> fds;
-  for (auto& fh : fhs) {
-    uint32_t offset = fh.frameOffset & 0x7FFFFFFF;
-    uint32_t size = fh.framesize;
-    fds.emplace_back(data.data() + offset, data.data() + offset + size);
-  }
-  if (fds.size() <= frame) return;
-
-  auto& fd = fds[frame];
-  FrameData* fdata = (FrameData*)fd.data();
-  static constexpr int32_t S = 2;
-  static constexpr uint32_t drawY = 32768;
-  uint32_t drawx = (int(dx) - int(dy)) / S - fdata->offx + drawY - deltax;
-  uint32_t drawy = (dx + dy) / (S*2) - dz - fdata->offy + drawY - deltay;
+// Objects that tie on depth are ordered by position and then shape, so the
+// result does not depend on the order they were loaded in and a cropped
+// render matches the same area of a full one.
+bool paintersOrder(const Shape& a, const Shape& b) {
+  if (a.z < b.z) return true;
+  else if (a.z > b.z) return false;
+  if (a.y + a.x < b.y + b.x) return true;
+  else if (a.y + a.x > b.y + b.x) return false;
+  return std::tie(a.x, a.shape, a.frame) < std::tie(b.x, b.shape, b.frame);
+}
 
-  for (size_t row = 0; row < fdata->height; row++) {
-    uint8_t* inbuf = (uint8_t*)&fdata->rowOffsets[row] + fdata->rowOffsets[row];
+std::vector<Shape> loadLevel(const char* name, GlobCache& globs, bool sorted = true) {
+    std::vector<Shape> shapes;
+    shapes.reserve(std::filesystem::file_size(name) / sizeof(Entry));
+    forEachShape(name, globs, [&](const Shape& s) { shapes.push_back(s); });
+    if (sorted) std::sort(shapes.begin(), shapes.end(), paintersOrder);
+    return shapes;
+}
 
-    uint32_t x = 0;
+// Everything one level render touches. Jobs share the archives but each
+// owns its bitmap and bounds. A tiled render draws through the shape cache
+// of whichever worker picked up the tile.
+struct Render {
+  Render(std::span<ShapeCache> caches, GlobCache& globs, const Options& options)
+  : caches(caches)
+  , globs(globs)
+  , options(options)
+  {
+  }
+  CachedShape* findShape(ShapeCache& shapecache, uint16_t shape, uint16_t frame, bool report = false) {
+    switch(shape) {
+    case 1592:
+    case 1593:
+    case 1594:
+    case 1608:
+    case 1609:
+      return nullptr;
+    }
+    CachedShape* cs = shapecache.get(shape);
+    if (!cs) {
+      if (report) printf("Cannot draw %s\n", std::to_string(shape).c_str());
+      return nullptr;
+    }
+    if (cs->frames.size() <= frame || !cs->frames[frame]) return nullptr;
+    return cs;
+  }
+  // Grows the level bounds by the frame rectangle. Only the frame header is
+  // looked at, so no pixel data is decoded to size the image.
+  void boundShape(const Shape& s) {
+    CachedShape* cs = findShape(caches[0], s.shape, s.frame, true);
+    if (!cs) return;
+    const FrameData* fdata = cs->frames[s.frame];
+    if (fdata->width == 0 || fdata->height == 0) return;
+    uint32_t x = screenX(s.x, s.y, fdata);
+    uint32_t y = screenY(s.x, s.y, s.z, fdata);
+    if (x < minx) minx = x;
+    if (x + fdata->width - 1 > maxx) maxx = x + fdata->width - 1;
+    if (y < miny) miny = y;
+    if (y + fdata->height - 1 > maxy) maxy = y + fdata->height - 1;
+  }
+  void drawShape(ShapeCache& shapecache, const Shape& s, const Clip& clip) {
+    CachedShape* cs = findShape(shapecache, s.shape, s.frame);
+    if (!cs) return;
 
-    while(x < fdata->width) {
-      // Skip N pixels
-      x += *inbuf;
-      inbuf++;
-      if(x >= fdata->width)
-        break;
+    const FrameData* fdata = cs->frames[s.frame];
+    uint32_t drawx = screenX(s.x, s.y, fdata) - deltax;
+    uint32_t drawy = screenY(s.x, s.y, s.z, fdata) - deltay;
 
-      uint8_t length = *inbuf++;
-      uint8_t type = 0;
+    const DecodedFrame& df = shapecache.decoded(*cs, s.frame);
+    for (auto& run : df.runs) {
+      bitmap.span(drawx + run.x, drawy + run.row, df.pixels.data() + run.offset, run.length, run.fill, clip);
+    }
+  }
+  // Front-to-back counterpart of drawShape: only pixels nobody in front has
+  // covered yet are written, so each output pixel is written exactly once and
+  // the image matches the painter's. A shape whose frame rectangle is covered
+  // already is dropped before it is decoded, unless it is only partly inside
+  // the clip; its opaque pixels inside the clip still count as painted, so the
+  // overdraw figure is that of the painter's draw whether or not the level is
+  // tiled. Shapes entirely outside the clip are no draw at all.
+  void drawShapeCulled(ShapeCache& shapecache, const Shape& s, const Clip& clip) {
+    CachedShape* cs = findShape(shapecache, s.shape, s.frame);
+    if (!cs) return;
 
-      if (fdata->compression == 1) {
-        type = length & 1;
-        length >>= 1;
+    const FrameData* fdata = cs->frames[s.frame];
+    int32_t drawx = screenX(s.x, s.y, fdata) - deltax;
+    int32_t drawy = screenY(s.x, s.y, s.z, fdata) - deltay;
+    int32_t x0 = std::max(drawx, clip.x0), x1 = std::min<int64_t>(int64_t(drawx) + fdata->width, clip.x1);
+    int32_t y0 = std::max(drawy, clip.y0), y1 = std::min<int64_t>(int64_t(drawy) + fdata->height, clip.y1);
+    if (x0 >= x1 || y0 >= y1) return;
+    bool hidden = true;
+    for (int32_t y = y0; y < y1 && hidden; y++) {
+      for (int32_t x = x0; x < x1 && hidden; x += tileSize - x % tileSize) {
+        const uint8_t* cov = covered.find(x, y);
+        hidden = cov && !memchr(cov, 0, std::min(x1 - x, tileSize - x % tileSize));
+      }
+    }
+    if (hidden) {
+      hiddenDraws++;
+      bool inside = x0 == drawx && y0 == drawy && x1 - x0 == int64_t(fdata->width) && y1 - y0 == int64_t(fdata->height);
+      if (inside && shapecache.index) {
+        paintedPixels += shapecache.index->frames(s.shape)[s.frame].opaque;
+      } else {
+        paintedPixels += clippedOpaque(shapecache.decoded(*cs, s.frame), drawx, drawy, clip);
       }
+      return;
+    }
 
-      if(type == 0) {
-        for (size_t n = 0; n < length; n++) {
-          putcolor(drawx + x, drawy + row, palette[*inbuf++]);
-          x++;
+    const DecodedFrame& df = shapecache.decoded(*cs, s.frame);
+    size_t painted = 0, written = 0;
+    for (auto& run : df.runs) {
+      int32_t y = drawy + run.row;
+      if (y < clip.y0 || y >= clip.y1) continue;
+      int32_t start = std::max<int32_t>(drawx + run.x, clip.x0);
+      int32_t end = std::min<int64_t>(int64_t(drawx) + run.x + run.length, clip.x1);
+      for (int32_t x = start; x < end; x++) {
+        uint8_t index = df.pixels[run.offset + (run.fill ? 0 : x - drawx - run.x)];
+        if (index == transparentIndex) continue;
+        painted++;
+        uint8_t* cov = covered.at(x, y);
+        if (*cov) continue;
+        *cov = 1;
+        written++;
+        bitmap.set(x, y, index);
+      }
+    }
+    paintedPixels += painted;
+    writtenPixels += written;
+  }
+  // The frame's opaque pixels that land inside the clip when drawn at x, y.
+  static size_t clippedOpaque(const DecodedFrame& df, int32_t x, int32_t y, const Clip& clip) {
+    size_t opaque = 0;
+    for (auto& run : df.runs) {
+      if (y + int32_t(run.row) < clip.y0 || y + int32_t(run.row) >= clip.y1) continue;
+      int32_t start = std::max<int32_t>(x + run.x, clip.x0);
+      int32_t end = std::min<int64_t>(int64_t(x) + run.x + run.length, clip.x1);
+      for (int32_t px = start; px < end; px++) {
+        opaque += df.pixels[run.offset + (run.fill ? 0 : px - x - run.x)] != transparentIndex;
+      }
+    }
+    return opaque;
+  }
+  // The shape's frame rectangle in bitmap coordinates, empty if it draws
+  // nothing.
+  Clip frameRect(const Shape& s) {
+    CachedShape* cs = findShape(caches[0], s.shape, s.frame);
+    if (!cs) return {};
+    const FrameData* fdata = cs->frames[s.frame];
+    if (fdata->width == 0 || fdata->height == 0) return {};
+    int32_t x = screenX(s.x, s.y, fdata) - deltax, y = screenY(s.x, s.y, s.z, fdata) - deltay;
+    return {x, y, int32_t(x + fdata->width), int32_t(y + fdata->height)};
+  }
+  // Bins every rectangle into the bitmap tiles it touches, keeping their
+  // order within each bin.
+  std::vector<std::vector<uint32_t>> binRects(const std::vector<Clip>& rects) {
+    size_t tilesx = (bitmap.w + tileSize - 1) / tileSize;
+    size_t tilesy = (bitmap.h + tileSize - 1) / tileSize;
+    std::vector<std::vector<uint32_t>> bins(tilesx * tilesy);
+    for (size_t n = 0; n < rects.size(); n++) {
+      const Clip& r = rects[n];
+      int64_t x0 = std::max(r.x0, 0), y0 = std::max(r.y0, 0);
+      int64_t x1 = std::min<int64_t>(r.x1, bitmap.w) - 1, y1 = std::min<int64_t>(r.y1, bitmap.h) - 1;
+      if (x0 > x1 || y0 > y1) continue;
+      for (int64_t ty = y0 / tileSize; ty <= y1 / tileSize; ty++) {
+        for (int64_t tx = x0 / tileSize; tx <= x1 / tileSize; tx++) {
+          bins[ty * tilesx + tx].push_back(n);
+        }
+      }
+    }
+    return bins;
+  }
+  // Bins shapes by their frame rectangles, keeping the painter's order.
+  std::vector<std::vector<uint32_t>> binShapes(const std::vector<Shape>& shapes) {
+    std::vector<Clip> rects;
+    rects.reserve(shapes.size());
+    for (auto& s : shapes) {
+      rects.push_back(frameRect(s));
+    }
+    return binRects(rects);
+  }
+  // Draws the binned tiles in parallel. Each tile only writes its own
+  // pixels, so the result matches a serial draw.
+  void drawTiled(const std::vector<Shape>& shapes) {
+    size_t tilesx = (bitmap.w + tileSize - 1) / tileSize;
+    std::vector<std::vector<uint32_t>> bins = binShapes(shapes);
+    parallelFor(bins.size(), caches.size(), [&](size_t t, size_t worker) {
+      int32_t x = (t % tilesx) * tileSize, y = (t / tilesx) * tileSize;
+      Clip clip{x, y, std::min<int32_t>(x + tileSize, bitmap.w), std::min<int32_t>(y + tileSize, bitmap.h)};
+      if (options.cull) {
+        for (auto it = bins[t].rbegin(); it != bins[t].rend(); ++it) {
+          drawShapeCulled(caches[worker], shapes[*it], clip);
         }
       } else {
-        for (size_t n = 0; n < length; n++) {
-          putcolor(drawx + x, drawy + row, palette[*inbuf]);
-          x++;
+        for (uint32_t n : bins[t]) {
+          drawShape(caches[worker], shapes[n], clip);
         }
-        inbuf++;
       }
-    }
+    });
   }
-}
+  // Rasterizes a shape into a depth buffer instead of the bitmap. Every pixel
+  // gets the depth of the front of the object's Typeinfo box along the view
+  // ray through it, packed above its colour and index, and the nearest value
+  // wins. A maximum does not depend on the order of the writes, so shapes can
+  // be drawn unsorted and from any number of threads.
+  void drawDepthShape(ShapeCache& shapecache, const Shape& s, TiledBuffer<uint64_t>& depth) {
+    CachedShape* cs = findShape(shapecache, s.shape, s.frame);
+    if (!cs) return;
 
-std::vector<std::vector<uint8_t>> globs;
-struct Shape {
-    uint16_t shape;
-    uint8_t frame;
-    int x, y, z;
-};
+    const FrameData* fdata = cs->frames[s.frame];
+    int64_t sx = int32_t(screenX(s.x, s.y, fdata) - drawY);
+    int64_t sy = int32_t(screenY(s.x, s.y, s.z, fdata) - drawY);
+    int64_t top = s.z + (s.shape < types.size() ? types.z[s.shape] * footZ : 0);
 
-void drawLevel(const char* name) {
-    maxx = 0;
-    maxy = 0;
-    minx = 2147483647;
-    miny = 2147483647;
-    std::vector<uint8_t> data;
-    data.resize(std::filesystem::file_size(name));
-    std::ifstream(name).read(reinterpret_cast<char*>(data.data()), data.size());
-    Entry* firstEntry = reinterpret_cast<Entry*>(data.data());
-    std::span<Entry> entries{firstEntry, firstEntry + data.size() / sizeof(Entry)};
-    std::vector<Shape> shapes;
-    for (auto& entry : entries) {
-      if (entry.type == 0x10) {
-        if (entry.count >= globs.size()) {
-          printf("invalid glob id %u\n", entry.count);
-        } else {
-          std::vector<uint8_t>& gv = globs[entry.count];
-          std::span<GlobEntry> ge{reinterpret_cast<GlobEntry*>(gv.data() + 2), reinterpret_cast<GlobEntry*>(gv.data() + gv.size())};
-          for (auto& e : ge) {
-            shapes.push_back({e.shapeindex, e.frame, entry.x + e.x*2 - 512, entry.y + e.y*2 - 512, entry.z + e.z});
-          }
+    const DecodedFrame& df = shapecache.decoded(*cs, s.frame);
+    for (auto& run : df.runs) {
+      int64_t py = sy + run.row;
+      int64_t y = py + drawY - deltay;
+      if (y < 0 || y >= int64_t(bitmap.h)) continue;
+      for (size_t n = 0; n < run.length; n++) {
+        int64_t px = sx + run.x + n;
+        int64_t x = px + drawY - deltax;
+        if (x < 0 || x >= int64_t(bitmap.w)) continue;
+        uint8_t index = df.pixels[run.offset + (run.fill ? 0 : n)];
+        if (index == transparentIndex) continue;
+        // Where the view ray through this pixel crosses z = 0; moving along
+        // the ray towards the viewer adds (1, 1, 1/2) per step.
+        int64_t x0 = 2 * py + px, y0 = 2 * py - px;
+        int64_t t = std::min({s.x - x0, s.y - y0, 2 * top});
+        uint64_t value = uint64_t(std::clamp<int64_t>(t + 0x80000000LL, 0, 0xFFFFFFFFLL)) << 32 | paletteLut[index] << 8 | index;
+        std::atomic_ref<uint64_t> cell(*depth.at(x, y));
+        uint64_t current = cell.load(std::memory_order_relaxed);
+        while (value > current && !cell.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
         }
-      } else {
-        shapes.push_back({entry.type, entry.frame, entry.x, entry.y, entry.z});
       }
     }
-    std::sort(shapes.begin(), shapes.end(), [](const Shape& a, const Shape& b) {
-      if (a.z < b.z) return true;
-      else if (a.z > b.z) return false;
-      if (a.y + a.x < b.y + b.x) return true;
-      else if (a.y + a.x > b.y + b.x) return false;
-      return false;
+  }
+  void drawDepth(const char* level, const std::vector<Shape>& shapes) {
+    static constexpr size_t chunk = 4096;
+    TiledBuffer<uint64_t> depth(bitmap.w, bitmap.h);
+    parallelFor((shapes.size() + chunk - 1) / chunk, caches.size(), [&](size_t c, size_t worker) {
+      for (size_t n = c * chunk; n < shapes.size() && n < (c + 1) * chunk; n++) {
+        drawDepthShape(caches[worker], shapes[n], depth);
+      }
     });
+    for (size_t y = 0; y < bitmap.h; y++) {
+      for (size_t x = 0; x < bitmap.w; x++) {
+        const uint64_t* cell = depth.find(x, y);
+        if (!cell) {
+          x += tileSize - 1 - x % tileSize;
+          continue;
+        }
+        uint8_t index = *cell;
+        if (index != transparentIndex) bitmap.set(x, y, index);
+      }
+    }
+    printf("%s: depth buffer %zu KB, %zu KB dense\n", level, depth.allocatedBytes() >> 10, (bitmap.w * bitmap.h * sizeof(uint64_t)) >> 10);
+  }
+  // Draws the painter's version of the level next to the depth-buffered one
+  // and reports how many pixels the two disagree on.
+  void compareWithPainter(const char* level, std::vector<Shape> shapes) {
+    Bitmap depthed = std::move(bitmap);
+    bitmap = Bitmap(depthed.w, depthed.h, options.indexed);
+    std::sort(shapes.begin(), shapes.end(), paintersOrder);
     for (auto& s : shapes) {
-      drawShape(s.shape, s.frame, s.x, s.y, s.z);
+      drawShape(caches[0], s, bitmap.bounds());
     }
-}
+    size_t drawn = 0, differ = 0;
+    for (size_t y = 0; y < bitmap.h; y++) {
+      for (size_t x = 0; x < bitmap.w; x++) {
+        uint32_t a = bitmap.color(x, y), b = depthed.color(x, y);
+        if (a || b) drawn++;
+        if (a != b) differ++;
+      }
+    }
+    printf("%s: depth buffer differs from painter in %zu of %zu drawn pixels (%.2f%%)\n", level, differ, drawn, drawn ? 100.0 * differ / drawn : 0.0);
+    bitmap = std::move(depthed);
+  }
+  // Editor-only markers never show up in the game, so they are not drawn.
+  void dropNonVisual(std::vector<Shape>& shapes) {
+    size_t before = shapes.size();
+    std::erase_if(shapes, [](const Shape& s) {
+      return types.has(s.shape, editor);
+    });
+    nonVisual = before - shapes.size();
+  }
+  // Only the objects that can reach the viewport, or that lie in the world
+  // region, found through the level's spatial index. Widening the viewport
+  // by the furthest any frame in the archive reaches from its anchor, and
+  // by the level's range of z, gives a diamond in world x/y, and its
+  // bounding box is what gets queried.
+  std::vector<Shape> loadRegion(const char* level) {
+    LevelIndex index = indexLevel(level, globs);
+    std::vector<Shape> shapes;
+    auto add = [&](const Shape& s) { shapes.push_back(s); };
+    if (options.regional) {
+      index.query(options.region[0], options.region[1], options.region[2], options.region[3], add);
+    } else if (!index.shapes.empty()) {
+      FrameIndex::Reach r = caches[0].index->reach();
+      auto [lowest, highest] = std::minmax_element(index.shapes.begin(), index.shapes.end(), [](const Shape& a, const Shape& b) { return a.z < b.z; });
+      const auto& v = options.view;
+      // One more pixel each way covers the rounding in screenX and screenY.
+      int64_t u0 = S * (int64_t(v[0]) - drawY - r.right - 1), u1 = S * (int64_t(v[2]) - drawY + r.left + 1);
+      int64_t w0 = S * 2 * (int64_t(v[1]) - drawY - r.down + lowest->z - 1), w1 = S * 2 * (int64_t(v[3]) - drawY + r.up + highest->z + 1);
+      index.query((u0 + w0) / 2, (w0 - u1) / 2, (u1 + w1) / 2 + 1, (w1 - u0) / 2 + 1, add);
+    }
+    if (!options.depth) std::sort(shapes.begin(), shapes.end(), paintersOrder);
+    return shapes;
+  }
+  // Whether the shape's frame rectangle overlaps the viewport.
+  bool inViewport(const Shape& s) {
+    CachedShape* cs = findShape(caches[0], s.shape, s.frame);
+    if (!cs) return false;
+    const FrameData* fdata = cs->frames[s.frame];
+    int64_t x = screenX(s.x, s.y, fdata), y = screenY(s.x, s.y, s.z, fdata);
+    const auto& v = options.view;
+    return x < v[2] && x + fdata->width > v[0] && y < v[3] && y + fdata->height > v[1];
+  }
+  // Halves four tiles, in reading order, into one. A blank child leaves its
+  // quarter black.
+  static Tile downsample(const Tile (&children)[4]) {
+    Tile out(tileSize * tileSize * 3);
+    uint32_t any = 0;
+    for (size_t c = 0; c < 4; c++) {
+      if (children[c].empty()) continue;
+      for (size_t y = 0; y < tileSize / 2; y++) {
+        const uint8_t* a = children[c].data() + 2 * y * tileSize * 3;
+        const uint8_t* b = a + tileSize * 3;
+        uint8_t* p = out.data() + ((c / 2 * tileSize / 2 + y) * tileSize + c % 2 * tileSize / 2) * 3;
+        for (size_t i = 0; i < tileSize / 2 * 3; i++) {
+          size_t k = i / 3 * 6 + i % 3;
+          p[i] = (a[k] + a[k + 3] + b[k] + b[k + 3] + 2) / 4;
+          any |= p[i];
+        }
+      }
+    }
+    if (!any) out.clear();
+    return out;
+  }
+  Tile drawBaseTile(size_t x, size_t y, size_t worker) {
+    size_t tilesx = (bitmap.w + tileSize - 1) / tileSize;
+    size_t t = y * tilesx + x;
+    Clip clip{int32_t(x * tileSize), int32_t(y * tileSize), std::min<int32_t>((x + 1) * tileSize, bitmap.w), std::min<int32_t>((y + 1) * tileSize, bitmap.h)};
+    for (uint32_t n : bins[t]) {
+      drawShape(caches[worker], binned[n], clip);
+    }
+    return bitmap.takeTile(t);
+  }
+  std::string tilePath(size_t z, size_t x, size_t y) const {
+    return tileDir + "/" + std::to_string(z) + "/" + std::to_string(x) + "/" + std::to_string(y) + ".png";
+  }
+  // Brings tile (x, y) of zoom level z and everything below it up to date on
+  // disk, and returns its pixels if needPixels is set. An unchanged tile is
+  // only read back when its changed parent needs it.
+  Tile buildTile(size_t z, size_t x, size_t y, bool needPixels, size_t worker) {
+    size_t i = y << z | x;
+    if (splitReady && z == splitZoom) return std::move(split[i]);
+    std::string name = tilePath(z, x, y);
+    if (pyramid.hashes[z][i] == previous.hashes[z][i]) {
+      if (!needPixels || !pyramid.written[z][i]) return {};
+      PngImage image = loadPng(name);
+      if (image.w == tileSize && image.h == tileSize && image.color == PngColor::rgb) return std::move(image.pixels);
+    }
+    Tile tile;
+    if (z == pyramid.maxZoom) {
+      if (pyramid.hashes[z][i]) tile = drawBaseTile(x, y, worker);
+    } else {
+      bool blank = pyramid.hashes[z][i] == 0;
+      Tile children[4];
+      for (size_t c = 0; c < 4; c++) {
+        children[c] = buildTile(z + 1, 2 * x + c % 2, 2 * y + c / 2, !blank, worker);
+      }
+      if (!blank) tile = downsample(children);
+    }
+    std::error_code ec;
+    if (!tile.empty()) {
+      std::filesystem::create_directories(std::filesystem::path(name).parent_path(), ec);
+      if (!savePng(name, tileSize, tileSize, PngColor::rgb, [&](size_t row, uint8_t* out) { memcpy(out, tile.data() + row * tileSize * 3, tileSize * 3); })) {
+        fprintf(stderr, "%s: cannot write\n", name.c_str());
+        writeFailed = true;
+        tileErrors++;
+      }
+      writtenTiles++;
+    } else if (pyramid.written[z][i]) {
+      std::filesystem::remove(name, ec);
+      removedTiles++;
+    }
+    pyramid.written[z][i] = !tile.empty();
+    return needPixels ? std::move(tile) : Tile();
+  }
+  // Writes the level as an XYZ pyramid of tileSize PNG tiles under
+  // <level>.tiles/<z>/<x>/<y>.png, zoom level 0 being the whole level in one
+  // tile. Blank tiles get no file. Only tiles whose hash differs from the
+  // manifest's are redrawn; delete the manifest to force a full rebuild. The
+  // base level is drawn a tile at a time and every parent is downsampled from
+  // its four children as soon as they are done, so the full image is never
+  // held in memory. Subtrees are built in parallel below the first zoom
+  // level with enough tiles to go round, and joined up serially above it.
+  void writePyramid(const char* level, const std::vector<Shape>& shapes) {
+    size_t tilesx = (bitmap.w + tileSize - 1) / tileSize, tilesy = (bitmap.h + tileSize - 1) / tileSize;
+    size_t maxZoom = 0;
+    while ((size_t(1) << maxZoom) < std::max(tilesx, tilesy)) maxZoom++;
+    tileDir = level + std::string(".tiles");
+    std::string manifest = tileDir + "/manifest";
+    std::error_code ec;
+    if (!previous.load(manifest) || previous.maxZoom != maxZoom) {
+      std::filesystem::remove_all(tileDir, ec);
+      previous = TilePyramid(maxZoom);
+    }
+    std::filesystem::create_directories(tileDir);
+    pyramid = previous;
+    binned = shapes;
+    bins = binShapes(shapes);
 
-int main(int argc, const char** argv) {
-  globs.resize(3072);
-  for (size_t n = 0; n < 3072; n++) {
-    globs[n].resize(std::filesystem::file_size("glob.flx." + std::to_string(n)));
-    std::ifstream("glob.flx." + std::to_string(n)).read(reinterpret_cast<char*>(globs[n].data()), globs[n].size());
+    // Base tiles hash the image layout and every object drawn into them,
+    // along with its shape's data; parents hash their children.
+    uint64_t seed = hashCombine(hashCombine(hashCombine(deltax, deltay), bitmap.w), bitmap.h);
+    std::unordered_map<uint16_t, uint64_t> shapeHashes;
+    for (size_t t = 0; t < bins.size(); t++) {
+      uint64_t h = 0;
+      if (!bins[t].empty()) {
+        h = seed;
+        for (uint32_t n : bins[t]) {
+          const Shape& s = shapes[n];
+          auto [it, added] = shapeHashes.try_emplace(s.shape);
+          if (added) it->second = hash64(shapeflx[s.shape]);
+          h = hashCombine(h, uint64_t(s.shape) << 40 | uint64_t(s.frame) << 32 | uint32_t(s.z));
+          h = hashCombine(h, uint64_t(uint32_t(s.x)) << 32 | uint32_t(s.y));
+          h = hashCombine(h, it->second) | 1;
+        }
+      }
+      pyramid.hashes[maxZoom][(t / tilesx) << maxZoom | t % tilesx] = h;
+    }
+    for (size_t z = maxZoom; z-- > 0;) {
+      for (size_t i = 0; i < pyramid.hashes[z].size(); i++) {
+        size_t x = i & ((size_t(1) << z) - 1), y = i >> z;
+        uint64_t h = seed, any = 0;
+        for (size_t c = 0; c < 4; c++) {
+          uint64_t child = pyramid.hashes[z + 1][(2 * y + c / 2) << (z + 1) | (2 * x + c % 2)];
+          h = hashCombine(h, child);
+          any |= child;
+        }
+        pyramid.hashes[z][i] = any ? h | 1 : 0;
+      }
+    }
+
+    size_t workers = caches.size();
+    splitZoom = 0;
+    while (workers > 1 && splitZoom < maxZoom && (size_t(1) << (2 * splitZoom)) < 4 * workers) splitZoom++;
+    size_t side = size_t(1) << splitZoom;
+    split.assign(side * side, Tile());
+    splitReady = false;
+    parallelFor(split.size(), workers, [&](size_t i, size_t worker) {
+      size_t x = i % side, y = i / side;
+      bool needPixels = splitZoom > 0 && pyramid.hashes[splitZoom - 1][(y / 2) << (splitZoom - 1) | x / 2] != previous.hashes[splitZoom - 1][(y / 2) << (splitZoom - 1) | x / 2];
+      split[y << splitZoom | x] = buildTile(splitZoom, x, y, needPixels, worker);
+    });
+    splitReady = true;
+    if (splitZoom > 0) buildTile(0, 0, 0, false, 0);
+    // With tiles missing the old manifest stays, so the next run redraws them.
+    if (!tileErrors) pyramid.save(manifest);
+    size_t files = 0;
+    for (auto& w : pyramid.written) files += std::count(w.begin(), w.end(), 1);
+    printf("%s: %zu zoom levels, %zu tiles written, %zu kept, %zu removed\n", level, maxZoom + 1, size_t(writtenTiles), files - writtenTiles, size_t(removedTiles));
   }
-  for (size_t n = 1; n < static_cast<size_t>(argc); n++) {
-    draw = false;
-    drawLevel(argv[n]);
-    printf("%zu %zu %zu %zu\n", minx, miny, maxx, maxy);
+  // The frames an animated object cycles through: every animSpeed steps it
+  // moves on to the next frame of its group of animdata frames, the one its
+  // stored frame is in, or of all the shape's frames when animdata is 0 or 1.
+  // The engine's random animation types play as plain loops, so an export
+  // is reproducible.
+  std::pair<size_t, size_t> animGroup(const Shape& s, size_t frames) {
+    size_t group = types.animdata[s.shape] > 1 ? types.animdata[s.shape] : frames;
+    size_t start = s.frame / group * group;
+    return {start, std::min(group, frames - start)};
+  }
+  bool animates(const CachedShape* cs, const Shape& s) {
+    return cs && cs->frames.size() >= 2 && s.shape < types.size() && types.animtype[s.shape];
+  }
+  // Widens the canvas bounds by every frame s can show while animating.
+  void boundAnimation(Shape s) {
+    CachedShape* cs = findShape(caches[0], s.shape, s.frame);
+    if (!animates(cs, s)) return;
+    auto [start, length] = animGroup(s, cs->frames.size());
+    for (s.frame = start; s.frame < start + length; s.frame++) {
+      boundShape(s);
+    }
+  }
+  uint8_t animFrame(const Shape& s, size_t frames, size_t step) {
+    auto [start, length] = animGroup(s, frames);
+    return start + (s.frame - start + step / types.animSpeed[s.shape]) % length;
+  }
+  // Renders options.frames steps of the level's animation. Shapes that do
+  // not animate are drawn once into a background layer. Every animated
+  // object gets a rectangle covering all the frames it can show, and each
+  // step only clears and redraws those rectangles, tile by tile from the
+  // tile's whole bin, so whatever is in front of an animated object still
+  // covers it. Steps share the background's other tiles, which also lets the
+  // sprite sheet be put together without copying them.
+  void animate(const char* level, std::vector<Shape>& shapes) {
+    std::vector<Clip> rects;
+    std::vector<uint32_t> animated;
+    std::vector<uint8_t> storedFrames;
+    std::vector<size_t> frameCounts;
+    std::vector<bool> isAnimated(shapes.size());
+    for (size_t n = 0; n < shapes.size(); n++) {
+      Shape s = shapes[n];
+      rects.push_back(frameRect(s));
+      CachedShape* cs = findShape(caches[0], s.shape, s.frame);
+      if (!animates(cs, s)) continue;
+      auto [start, length] = animGroup(s, cs->frames.size());
+      Clip& r = rects.back();
+      for (s.frame = start; s.frame < start + length; s.frame++) {
+        Clip f = frameRect(s);
+        if (f.x0 >= f.x1) continue;
+        if (r.x0 >= r.x1) r = f;
+        r = {std::min(r.x0, f.x0), std::min(r.y0, f.y0), std::max(r.x1, f.x1), std::max(r.y1, f.y1)};
+      }
+      animated.push_back(n);
+      storedFrames.push_back(shapes[n].frame);
+      frameCounts.push_back(cs->frames.size());
+      isAnimated[n] = true;
+    }
+    bins = binRects(rects);
+
+    // What each tile has to redraw per step: the bounding box of the
+    // animated rectangles within it.
+    size_t tilesx = (bitmap.w + tileSize - 1) / tileSize;
+    std::vector<Clip> dirty(bins.size(), {INT_MAX, INT_MAX, INT_MIN, INT_MIN});
+    for (uint32_t n : animated) {
+      const Clip& r = rects[n];
+      int32_t x0 = std::max(r.x0, 0), y0 = std::max(r.y0, 0);
+      int32_t x1 = std::min<int64_t>(r.x1, bitmap.w), y1 = std::min<int64_t>(r.y1, bitmap.h);
+      for (int32_t ty = y0 / tileSize; ty * tileSize < y1; ty++) {
+        for (int32_t tx = x0 / tileSize; tx * tileSize < x1; tx++) {
+          Clip& d = dirty[ty * tilesx + tx];
+          d = {std::min(d.x0, std::max(x0, tx * tileSize)), std::min(d.y0, std::max(y0, ty * tileSize)),
+               std::max(d.x1, std::min(x1, (tx + 1) * tileSize)), std::max(d.y1, std::min(y1, (ty + 1) * tileSize))};
+        }
+      }
+    }
+    std::vector<uint32_t> dirtyTiles;
+    size_t dirtyPixels = 0;
+    for (size_t t = 0; t < dirty.size(); t++) {
+      if (dirty[t].x0 >= dirty[t].x1) continue;
+      dirtyTiles.push_back(t);
+      dirtyPixels += size_t(dirty[t].x1 - dirty[t].x0) * (dirty[t].y1 - dirty[t].y0);
+    }
+
+    parallelFor(bins.size(), caches.size(), [&](size_t t, size_t worker) {
+      int32_t x = (t % tilesx) * tileSize, y = (t / tilesx) * tileSize;
+      Clip clip{x, y, std::min<int32_t>(x + tileSize, bitmap.w), std::min<int32_t>(y + tileSize, bitmap.h)};
+      for (uint32_t n : bins[t]) {
+        if (!isAnimated[n]) drawShape(caches[worker], shapes[n], clip);
+      }
+    });
+    // Full resolution; save() scales bitmap down in place with -x.
+    Bitmap background = bitmap;
+    size_t width = background.w, height = background.h;
+    std::vector<Bitmap> steps;
+    for (size_t step = 0; step < options.frames; step++) {
+      for (size_t i = 0; i < animated.size(); i++) {
+        Shape s = shapes[animated[i]];
+        s.frame = storedFrames[i];
+        shapes[animated[i]].frame = animFrame(s, frameCounts[i], step);
+      }
+      bitmap = background;
+      parallelFor(dirtyTiles.size(), caches.size(), [&](size_t i, size_t worker) {
+        size_t t = dirtyTiles[i];
+        bitmap.unshare(t);
+        bitmap.clear(dirty[t]);
+        for (uint32_t n : bins[t]) {
+          drawShape(caches[worker], shapes[n], dirty[t]);
+        }
+      });
+      if (options.sheet) {
+        steps.push_back(std::move(bitmap));
+      } else {
+        save(bitmap, level + std::string(".") + std::to_string(step));
+      }
+    }
+    for (size_t i = 0; i < animated.size(); i++) {
+      shapes[animated[i]].frame = storedFrames[i];
+    }
+    printf("%s: %zu steps, %zu animated objects; %zu of %zu tiles, %.1f%% of the pixels, redrawn per step\n", level, options.frames,
+           animated.size(), dirtyTiles.size(), bins.size(), 100.0 * dirtyPixels / (width * height));
+    if (options.sheet && !steps.empty()) {
+      // Steps are stacked top to bottom, each starting on a tile row, so the
+      // sheet is just their tiles one after another.
+      size_t cell = (height + tileSize - 1) / tileSize * tileSize;
+      bitmap = Bitmap(width, cell * (steps.size() - 1) + height, options.indexed);
+      for (size_t k = 0; k < steps.size(); k++) {
+        std::move(steps[k].tiles.begin(), steps[k].tiles.end(), bitmap.tiles.begin() + k * cell / tileSize * tilesx);
+      }
+      printf("%s: sheet of %zu steps of %zu x %zu, one every %zu rows\n", level, steps.size(), width, height, cell);
+      save(bitmap, level + std::string(".anim"));
+    }
+  }
+  // Saves image as name.png or name.bmp, scaled down first if asked to.
+  void save(Bitmap& image, const std::string& name) {
+    if (options.scale > 1) image = image.downscaled(options.scale);
+    std::string file = name + (options.png ? ".png" : ".bmp");
+    if (!(options.png ? image.SavePng(file, caches.size()) : image.Save(file))) {
+      fprintf(stderr, "%s: cannot write\n", file.c_str());
+      writeFailed = true;
+    }
+  }
+  void render(const char* level) {
+    std::vector<Shape> shapes = options.viewport || options.regional ? loadRegion(level) : loadLevel(level, globs, !options.depth);
+    if (options.cull) dropNonVisual(shapes);
+    if (options.viewport) {
+      std::erase_if(shapes, [&](const Shape& s) { return !inViewport(s); });
+      minx = options.view[0];
+      miny = options.view[1];
+      maxx = options.view[2] - 1;
+      maxy = options.view[3] - 1;
+    } else {
+      // With -a the canvas has to hold every frame of the animation, not
+      // just the stored ones.
+      for (auto& s : shapes) {
+        boundShape(s);
+        if (options.frames && !options.pyramid) boundAnimation(s);
+      }
+    }
+    if (minx > maxx || miny > maxy) {
+      printf("%s: nothing to draw\n", level);
+      return;
+    }
+    printf("%s: %zu %zu %zu %zu\n", level, minx, miny, maxx, maxy);
     deltax = minx;
     deltay = miny;
-    imagewidth = maxx - minx + 1;
-    imageheight = maxy - miny + 1;
-    _b = Bitmap(imagewidth, imageheight);
-    draw = true;
-    drawLevel(argv[n]);
-    printf("%zu %zu %zu %zu\n", minx, miny, maxx, maxy);
-    _b.Save(argv[n] + std::string(".bmp"));
+    bitmap = Bitmap(maxx - minx + 1, maxy - miny + 1, options.indexed);
+    if (options.pyramid) {
+      writePyramid(level, shapes);
+      return;
+    }
+    if (options.frames) {
+      animate(level, shapes);
+      return;
+    }
+    if (options.depth) {
+      drawDepth(level, shapes);
+      if (options.compare) compareWithPainter(level, std::move(shapes));
+    } else if (options.cull) {
+      covered = TiledBuffer<uint8_t>(bitmap.w, bitmap.h);
+      if (options.tiled) {
+        drawTiled(shapes);
+      } else {
+        for (auto it = shapes.rbegin(); it != shapes.rend(); ++it) {
+          drawShapeCulled(caches[0], *it, bitmap.bounds());
+        }
+      }
+      printf("%s: overdraw %.2fx before culling (%zu pixels painted, %zu written); %zu non-visual shapes, %zu hidden draws skipped\n", level,
+             writtenPixels ? double(paintedPixels) / writtenPixels : 0.0, size_t(paintedPixels), size_t(writtenPixels), nonVisual, size_t(hiddenDraws));
+      printf("%s: coverage mask %zu KB, %zu KB dense\n", level, covered.allocatedBytes() >> 10, (bitmap.w * bitmap.h) >> 10);
+    } else if (options.tiled) {
+      drawTiled(shapes);
+    } else {
+      for (auto& s : shapes) {
+        drawShape(caches[0], s, bitmap.bounds());
+      }
+    }
+    // Before save(), which scales bitmap down in place with -x.
+    printf("%s: framebuffer %zu KB, %zu KB dense\n", level, bitmap.allocatedBytes() >> 10, (bitmap.w * bitmap.h * bitmap.bpp) >> 10);
+    save(bitmap, level);
   }
-}
+  std::span<ShapeCache> caches;
+  GlobCache& globs;
+  const Options& options;
+  Bitmap bitmap;
+  TiledBuffer<uint8_t> covered;
+  std::atomic<size_t> paintedPixels{0}, writtenPixels{0}, hiddenDraws{0};
+  size_t nonVisual = 0;
+  std::string tileDir;
+  TilePyramid pyramid, previous;
+  std::span<const Shape> binned;
+  std::vector<std::vector<uint32_t>> bins;
+  size_t splitZoom = 0;
+  std::vector<Tile> split;
+  bool splitReady = false;
+  std::atomic<size_t> writtenTiles{0}, removedTiles{0}, tileErrors{0};
+  size_t deltax = 0, deltay = 0;
+  size_t maxx = 0, maxy = 0, minx = 2147483647, miny = 2147483647;
+};
 
+int main(int argc, const char** argv) {
+  std::vector<const char*> levels;
+  size_t budget = 64 << 20;
+  size_t jobs = 1;
+  Options options;
+  for (size_t n = 1; n < static_cast<size_t>(argc); n++) {
+    if (argv[n] == std::string("-m") && n + 1 < static_cast<size_t>(argc)) {
+      budget = std::stoul(argv[++n]) << 20;
+    } else if (argv[n] == std::string("-j") && n + 1 < static_cast<size_t>(argc)) {
+      jobs = workerCount(std::stoul(argv[++n]));
+    } else if (argv[n] == std::string("-t")) {
+      options.tiled = true;
+    } else if (argv[n] == std::string("-z") && n + 1 < static_cast<size_t>(argc)) {
+      types = TypeTable::load(argv[++n]);
+      options.depth = true;
+    } else if (argv[n] == std::string("-o") && n + 1 < static_cast<size_t>(argc)) {
+      types = TypeTable::load(argv[++n]);
+      options.cull = true;
+    } else if (argv[n] == std::string("-c")) {
+      options.compare = true;
+    } else if ((argv[n] == std::string("-v") || argv[n] == std::string("-w")) && n + 4 < static_cast<size_t>(argc)) {
+      bool world = argv[n] == std::string("-w");
+      for (auto& r : world ? options.region : options.view) r = std::stoi(argv[++n]);
+      (world ? options.regional : options.viewport) = true;
+    } else if (argv[n] == std::string("-x") && n + 1 < static_cast<size_t>(argc)) {
+      options.scale = std::max<size_t>(1, std::stoul(argv[++n]));
+    } else if (argv[n] == std::string("-i")) {
+      options.indexed = true;
+    } else if (argv[n] == std::string("-p")) {
+      options.png = true;
+    } else if (argv[n] == std::string("-s")) {
+      blitReference = true;
+    } else if (argv[n] == std::string("-a") && n + 2 < static_cast<size_t>(argc)) {
+      types = TypeTable::load(argv[++n]);
+      options.frames = std::stoul(argv[++n]);
+    } else if (argv[n] == std::string("-g")) {
+      options.sheet = true;
+    } else if (argv[n] == std::string("-y")) {
+      options.pyramid = true;
+    } else {
+      levels.push_back(argv[n]);
+    }
+  }
+  shapeflx = FlxArchive("shapes.flx");
+  globflx = FlxArchive("glob.flx");
+  FrameIndex frameIndex = indexFrames(shapeflx, "shapes.flx");
+  GlobCache globs(globflx);
+  // One cache per worker, splitting the budget, so no locking is needed.
+  std::vector<ShapeCache> caches;
+  for (size_t n = 0; n < jobs; n++) {
+    caches.emplace_back(shapeflx, budget / jobs, &frameIndex);
+  }
+  if (options.tiled || options.depth || options.pyramid || options.frames) {
+    // Levels one at a time, with all workers sharing the work of each.
+    for (const char* level : levels) {
+      Render(caches, globs, options).render(level);
+    }
+  } else {
+    parallelFor(levels.size(), jobs, [&](size_t n, size_t worker) {
+      Render({&caches[worker], 1}, globs, options).render(levels[n]);
+    });
+  }
+  size_t hits = 0, misses = 0, evictions = 0, used = 0, shared = 0;
+  for (auto& cache : caches) {
+    hits += cache.hits;
+    misses += cache.misses;
+    evictions += cache.evictions;
+    shared += cache.sharedDecodes;
+    used += cache.used;
+  }
+  printf("shape cache: %zu hits, %zu misses, %zu evictions, %zu bytes, %zu decodes shared with identical frames\n", hits, misses, evictions, used, shared);
+  return writeFailed ? 1 : 0;
+}
@@ -0,0 +1,211 @@
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <span>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "FlxArchive.h"
+#include "Palette.h"
+#include "Rle.h"
+#include "ShapeCache.h"
+
+// The half-open rectangle of the frame's opaque pixels; empty (x0 >= x1) if
+// it has none.
+struct BoundsSink {
+  uint32_t x0 = UINT32_MAX, y0 = UINT32_MAX, x1 = 0, y1 = 0;
+  void add(uint32_t row, uint32_t first, uint32_t last) {
+    x0 = std::min(x0, first);
+    x1 = std::max(x1, last + 1);
+    y0 = std::min(y0, row);
+    y1 = row + 1;
+  }
+  void literal(uint32_t row, uint32_t x, const uint8_t* src, uint32_t length) {
+    uint32_t first = 0, last = length;
+    while (first < length && paletteKey[src[first]] == transparentIndex) first++;
+    while (last > first && paletteKey[src[last - 1]] == transparentIndex) last--;
+    if (first < last) add(row, x + first, x + last - 1);
+  }
+  void fill(uint32_t row, uint32_t x, uint8_t index, uint32_t length) {
+    if (length && paletteKey[index] != transparentIndex) add(row, x, x + length - 1);
+  }
+};
+
+// Sets a byte per opaque pixel in a mask, stride bytes per row.
+struct CoverageSink {
+  uint8_t* mask;
+  ptrdiff_t stride;
+  void literal(uint32_t row, uint32_t x, const uint8_t* src, uint32_t length) {
+    uint8_t* m = mask + row * stride + x;
+    for (uint32_t n = 0; n < length; n++) {
+      m[n] |= paletteKey[src[n]] != transparentIndex;
+    }
+  }
+  void fill(uint32_t row, uint32_t x, uint8_t index, uint32_t length) {
+    if (paletteKey[index] != transparentIndex) memset(mask + row * stride + x, 1, length);
+  }
+};
+
+// The decode loop as it was before decodeRle: the compression mode is
+// tested for every run.
+template <typename Sink>
+static void decodeRleGeneric(const FrameData* fdata, Sink& sink) {
+  for (uint32_t row = 0; row < fdata->height; row++) {
+    const uint8_t* inbuf = (const uint8_t*)&fdata->rowOffsets[row] + fdata->rowOffsets[row];
+    uint32_t x = 0;
+    while (x < fdata->width) {
+      x += *inbuf;
+      inbuf++;
+      if (x >= fdata->width) break;
+      uint8_t length = *inbuf++;
+      uint8_t type = 0;
+      if (fdata->compression == 1) {
+        type = length & 1;
+        length >>= 1;
+      }
+      if (type == 0) {
+        sink.literal(row, x, inbuf, length);
+        inbuf += length;
+      } else {
+        sink.fill(row, x, *inbuf, length);
+        inbuf++;
+      }
+      x += length;
+    }
+  }
+}
+
+// The DecodedFrame builder as it was, a pixel at a time.
+static DecodedFrame decodeFrameGeneric(const FrameData* fdata) {
+  DecodedFrame df;
+  for (size_t row = 0; row < fdata->height; row++) {
+    const uint8_t* inbuf = (const uint8_t*)&fdata->rowOffsets[row] + fdata->rowOffsets[row];
+    uint32_t x = 0;
+    while (x < fdata->width) {
+      x += *inbuf;
+      inbuf++;
+      if (x >= fdata->width) break;
+      uint8_t length = *inbuf++;
+      uint8_t type = 0;
+      if (fdata->compression == 1) {
+        type = length & 1;
+        length >>= 1;
+      }
+      df.runs.push_back({uint32_t(row), x, length, uint32_t(df.pixels.size()), type == 1});
+      if (type == 0) {
+        for (size_t n = 0; n < length; n++) {
+          uint8_t index = paletteKey[inbuf[n]];
+          if (index != transparentIndex) df.opaque++;
+          df.pixels.push_back(index);
+        }
+        inbuf += length;
+      } else {
+        uint8_t index = paletteKey[*inbuf];
+        if (index != transparentIndex) df.opaque += length;
+        df.pixels.push_back(index);
+        inbuf++;
+      }
+      x += length;
+    }
+  }
+  return df;
+}
+
+template <typename F>
+static double timeIt(size_t iterations, F&& f) {
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < iterations; i++) f();
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// rlebench shapes.flx [iterations]
+// Decodes every frame of the archive into each kind of sink, with the old
+// per-run compression test and with decodeRle, checks that both give the
+// same result and prints the time per frame.
+int main(int argc, const char** argv) {
+  FlxArchive archive(argv[1]);
+  size_t iterations = argc > 2 ? std::stoul(argv[2]) : 20;
+  std::vector<const FrameData*> frames;
+  size_t largest = 0, invalid = 0;
+  for (size_t shape = 0; shape < archive.size(); shape++) {
+    std::span<const uint8_t> data = archive[shape];
+    const FrameHeader* fhs = reinterpret_cast<const FrameHeader*>(data.data() + sizeof(ShpHeader));
+    for (size_t n = 0; n < framesInShape(data); n++) {
+      if (validateFrame(data, n)) {
+        invalid++;
+        continue;
+      }
+      frames.push_back(reinterpret_cast<const FrameData*>(data.data() + (fhs[n].frameOffset & 0x7FFFFFFF)));
+      largest = std::max<size_t>(largest, size_t(frames.back()->width) * frames.back()->height);
+    }
+  }
+  std::vector<uint8_t> a(largest * 3), b(largest * 3);
+  printf("%zu frames (%zu invalid ones skipped), %zu iterations\n%-10s %12s %12s %8s\n", frames.size(), invalid, iterations, "sink", "generic ns", "decodeRle ns", "speedup");
+  auto report = [&](const char* sink, double before, double after, bool same) {
+    double scale = 1e9 / (iterations * frames.size());
+    printf("%-10s %12.1f %12.1f %7.2fx%s\n", sink, before * scale, after * scale, before / after, same ? "" : "  MISMATCH");
+  };
+  auto compare = [&](auto makeSink, size_t bpp, const char* name) {
+    bool same = true;
+    for (auto* f : frames) {
+      memset(a.data(), 0, size_t(f->width) * f->height * bpp);
+      memset(b.data(), 0, size_t(f->width) * f->height * bpp);
+      auto sa = makeSink(a.data(), f);
+      auto sb = makeSink(b.data(), f);
+      decodeRleGeneric(f, sa);
+      decodeRle(f, sb);
+      same = same && !memcmp(a.data(), b.data(), size_t(f->width) * f->height * bpp);
+    }
+    double before = timeIt(iterations, [&] {
+      for (auto* f : frames) {
+        auto sink = makeSink(a.data(), f);
+        decodeRleGeneric(f, sink);
+      }
+    });
+    double after = timeIt(iterations, [&] {
+      for (auto* f : frames) decodeRle(f, makeSink(b.data(), f));
+    });
+    report(name, before, after, same);
+  };
+  compare([](uint8_t* out, const FrameData* f) { return IndexedSink{out, ptrdiff_t(f->width)}; }, 1, "indexed");
+  compare([](uint8_t* out, const FrameData* f) { return Bgr24Sink{out, ptrdiff_t(f->width) * 3}; }, 3, "bgr24");
+  compare([](uint8_t* out, const FrameData* f) { return CoverageSink{out, ptrdiff_t(f->width)}; }, 1, "coverage");
+
+  bool same = true;
+  volatile size_t area = 0;
+  for (auto* f : frames) {
+    BoundsSink sa, sb;
+    decodeRleGeneric(f, sa);
+    decodeRle(f, sb);
+    same = same && sa.x0 == sb.x0 && sa.y0 == sb.y0 && sa.x1 == sb.x1 && sa.y1 == sb.y1;
+    if (sb.x0 < sb.x1) area = area + size_t(sb.x1 - sb.x0) * (sb.y1 - sb.y0);
+  }
+  double before = timeIt(iterations, [&] {
+    for (auto* f : frames) {
+      BoundsSink sink;
+      decodeRleGeneric(f, sink);
+      area = area + sink.x1;
+    }
+  });
+  double after = timeIt(iterations, [&] {
+    for (auto* f : frames) {
+      BoundsSink sink;
+      decodeRle(f, sink);
+      area = area + sink.x1;
+    }
+  });
+  report("bounds", before, after, same);
+
+  same = true;
+  for (auto* f : frames) {
+    DecodedFrame da = decodeFrameGeneric(f), db = decodeFrame(f);
+    same = same && da.pixels == db.pixels && da.opaque == db.opaque && da.runs.size() == db.runs.size();
+  }
+  before = timeIt(iterations, [&] {
+    for (auto* f : frames) area = area + decodeFrameGeneric(f).opaque;
+  });
+  after = timeIt(iterations, [&] {
+    for (auto* f : frames) area = area + decodeFrame(f).opaque;
+  });
+  report("runs", before, after, same);
+}
@@ -0,0 +1,114 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <span>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "FlxArchive.h"
+#include "Rle.h"
+#include "ShapeCache.h"
+
+// Stands between decodeRle and a real sink and fails loudly if a run
+// reaches outside the frame or reads pixels from outside the shape's data.
+template <typename Sink>
+struct CheckedSink {
+  Sink sink;
+  std::span<const uint8_t> shape;
+  const FrameData* fdata;
+  void check(uint32_t row, uint32_t x, uint32_t length, const uint8_t* src, size_t bytes) {
+    if (row >= fdata->height || x > fdata->width || length > fdata->width - x || src < shape.data() ||
+        src + bytes > shape.data() + shape.size()) {
+      fprintf(stderr, "validated frame decodes out of bounds: row %u x %u length %u\n", row, x, length);
+      abort();
+    }
+  }
+  void literal(uint32_t row, uint32_t x, const uint8_t* src, uint32_t length) {
+    check(row, x, length, src, length);
+    sink.literal(row, x, src, length);
+  }
+  void fill(uint32_t row, uint32_t x, uint8_t index, uint32_t length) {
+    check(row, x, length, shape.data(), 0);
+    sink.fill(row, x, index, length);
+  }
+};
+
+// Validates every frame of one shape and decodes the ones that pass into
+// buffers of exactly the frame's size. Returns how many passed.
+static size_t fuzzShape(std::span<const uint8_t> shape) {
+  size_t passed = 0;
+  for (size_t n = 0; n < framesInShape(shape); n++) {
+    if (validateFrame(shape, n)) continue;
+    const FrameHeader* fh = reinterpret_cast<const FrameHeader*>(shape.data() + sizeof(ShpHeader)) + n;
+    const FrameData* fdata = reinterpret_cast<const FrameData*>(shape.data() + (fh->frameOffset & 0x7FFFFFFF));
+    // Validation does not limit the frame size, so keep the buffers sane.
+    if (size_t(fdata->width) * fdata->height > (size_t(64) << 20)) continue;
+    std::vector<uint8_t> pixels(size_t(fdata->width) * fdata->height * 3);
+    decodeRle(fdata, CheckedSink<IndexedSink>{{pixels.data(), ptrdiff_t(fdata->width)}, shape, fdata});
+    decodeRle(fdata, CheckedSink<Bgr24Sink>{{pixels.data(), ptrdiff_t(fdata->width) * 3}, shape, fdata});
+    decodeRle(fdata, CheckedSink<OpaqueSink>{{}, shape, fdata});
+    DecodedFrame df;
+    decodeRle(fdata, CheckedSink<DecodedFrameSink>{{df}, shape, fdata});
+    passed++;
+  }
+  return passed;
+}
+
+// Built with -fsanitize=fuzzer,address and -DRLEFUZZ_LIBFUZZER this is a
+// libFuzzer target taking a shape as input.
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+  // A copy of exactly the input's size, so a sanitizer sees any overread.
+  std::vector<uint8_t> shape(data, data + size);
+  fuzzShape(shape);
+  return 0;
+}
+
+#ifndef RLEFUZZ_LIBFUZZER
+// rlefuzz shapes.flx [iterations] [seed]
+// Stand-alone fuzzing without libFuzzer: takes the shapes of an archive,
+// corrupts copies of them at random (flipped bytes, overwritten offsets,
+// truncation) and runs each through validation and decoding. Aborts on the
+// first validated frame that decodes out of bounds. Build with
+// -fsanitize=address to also catch stray reads of skip and length bytes.
+int main(int argc, const char** argv) {
+  FlxArchive archive(argv[1]);
+  size_t iterations = argc > 2 ? std::stoul(argv[2]) : 100000;
+  std::mt19937_64 rng(argc > 3 ? std::stoul(argv[3]) : 1);
+  std::vector<std::span<const uint8_t>> seeds;
+  for (size_t n = 0; n < archive.size(); n++) {
+    if (!archive[n].empty()) seeds.push_back(archive[n]);
+  }
+  if (seeds.empty()) return 1;
+  static constexpr uint32_t interesting[] = {0, 1, 0x7F, 0x80, 0xFF, 0x7FFF, 0xFFFF, 0x7FFFFFFF, 0x80000000, 0xFFFFFFFF};
+  size_t frames = 0, passed = 0;
+  for (size_t i = 0; i < iterations; i++) {
+    std::span<const uint8_t> seed = seeds[rng() % seeds.size()];
+    std::vector<uint8_t> shape(seed.begin(), seed.end());
+    for (size_t m = rng() % 4 + 1; m > 0 && !shape.empty(); m--) {
+      size_t at = rng() % shape.size();
+      switch (rng() % 4) {
+      case 0:
+        shape[at] ^= 1 << (rng() % 8);
+        break;
+      case 1:
+        shape[at] = rng();
+        break;
+      case 2:
+        if (at + 4 <= shape.size()) {
+          uint32_t value = interesting[rng() % std::size(interesting)];
+          memcpy(&shape[at], &value, 4);
+        }
+        break;
+      case 3:
+        shape.resize(at);
+        break;
+      }
+    }
+    shape.shrink_to_fit();
+    frames += framesInShape(shape);
+    passed += fuzzShape(shape);
+  }
+  printf("%zu shapes, %zu frames, %zu validated and decoded cleanly\n", iterations, frames, passed);
+}
+#endif
@@ -1,382 +1,208 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
 #include <filesystem>
 #include <fstream>
+#include <numeric>
 #include <span>
 #include <vector>
+#include <array>
+#include <cstring>
 #include <cstdint>
 #include <unordered_map>
-
-struct [[gnu::packed]] ShpHeader {
-  uint16_t maxX;
-  uint16_t maxY;
-  uint16_t count;
-};
-
-struct [[gnu::packed]] FrameHeader {
-  uint32_t frameOffset; // ignore top bit
-  uint32_t framesize;
-};
-
-struct [[gnu::packed]] FrameData {
-  uint16_t imageId;
-  uint16_t frameId;
-  uint32_t absoluteOffset;
-  uint32_t compression;
-  uint32_t width;
-  uint32_t height;
-  uint32_t x;
-  uint32_t y;
-  uint32_t rowOffsets[1];
-};
+#include "FlxArchive.h"
+#include "Dedup.h"
+#include "FrameIndex.h"
+#include "Palette.h"
+#include "Parallel.h"
+#include "Png.h"
+#include "Rle.h"
+#include "Shape.h"
+#include "Skyline.h"
 
 static std::array<uint8_t, 54> bmpheader = {
   0x42, 0x4d, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x36, 0x00, 0x00, 0x00, 0x28, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x01, 0x00, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00, 0x30, 0x00, 0x00, 0x00, 0x23, 0x2e, 0x00, 0x00, 0x23, 0x2e, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
 };
 
-struct Color {
-  uint8_t r, g, b;
+struct Frame {
+  size_t shape, frame;
+  const FrameData* data;
+  uint64_t pixels;
+  DedupFiles::Content content;
 };
 
-Color palette[256] = {
-  { 0x00, 0x00, 0x00 },
-  { 0x3f, 0x3f, 0x2f },
-  { 0x3e, 0x3c, 0x08 },
-  { 0x3f, 0x32, 0x07 },
-  { 0x3f, 0x29, 0x05 },
-  { 0x3f, 0x1f, 0x03 },
-  { 0x3f, 0x16, 0x02 },
-  { 0x3f, 0x0c, 0x00 },
-  { 0x00, 0x00, 0x00 },
-  { 0x3f, 0x3f, 0x11 },
-  { 0x3f, 0x15, 0x14 },
-  { 0x13, 0x29, 0x14 },
-  { 0x00, 0x1d, 0x2f },
-  { 0x3f, 0x3f, 0x33 },
-  { 0x3f, 0x3f, 0x32 },
-  { 0x3f, 0x3f, 0x35 },
-  { 0x3f, 0x3f, 0x3f },
-  { 0x3a, 0x3a, 0x3a },
-  { 0x35, 0x35, 0x35 },
-  { 0x30, 0x30, 0x30 },
-  { 0x2b, 0x2b, 0x2b },
-  { 0x26, 0x26, 0x26 },
-  { 0x22, 0x22, 0x22 },
-  { 0x1d, 0x1d, 0x1d },
-  { 0x19, 0x19, 0x19 },
-  { 0x16, 0x16, 0x16 },
-  { 0x12, 0x12, 0x12 },
-  { 0x0e, 0x0e, 0x0e },
-  { 0x0b, 0x0b, 0x0b },
-  { 0x07, 0x07, 0x07 },
-  { 0x03, 0x03, 0x03 },
-  { 0x00, 0x00, 0x00 },
-  { 0x35, 0x1b, 0x11 },
-  { 0x2e, 0x19, 0x11 },
-  { 0x27, 0x17, 0x11 },
-  { 0x21, 0x15, 0x12 },
-  { 0x1a, 0x13, 0x12 },
-  { 0x13, 0x10, 0x13 },
-  { 0x0d, 0x0e, 0x13 },
-  { 0x06, 0x0c, 0x13 },
-  { 0x36, 0x2d, 0x13 },
-  { 0x31, 0x29, 0x13 },
-  { 0x2d, 0x24, 0x14 },
-  { 0x28, 0x20, 0x15 },
-  { 0x23, 0x1c, 0x15 },
-  { 0x1f, 0x18, 0x16 },
-  { 0x1a, 0x14, 0x17 },
-  { 0x15, 0x0f, 0x17 },
-  { 0x36, 0x36, 0x3a },
-  { 0x31, 0x32, 0x37 },
-  { 0x2d, 0x2f, 0x33 },
-  { 0x29, 0x2b, 0x30 },
-  { 0x24, 0x27, 0x2d },
-  { 0x20, 0x23, 0x29 },
-  { 0x1b, 0x20, 0x26 },
-  { 0x17, 0x1c, 0x23 },
-  { 0x13, 0x18, 0x1f },
-  { 0x10, 0x15, 0x1b },
-  { 0x0d, 0x11, 0x16 },
-  { 0x0b, 0x0e, 0x12 },
-  { 0x08, 0x0b, 0x0e },
-  { 0x05, 0x07, 0x09 },
-  { 0x03, 0x04, 0x05 },
-  { 0x3e, 0x3c, 0x08 },
-  { 0x00, 0x18, 0x37 },
-  { 0x00, 0x0c, 0x1c },
-  { 0x3e, 0x38, 0x08 },
-  { 0x22, 0x08, 0x02 },
-  { 0x00, 0x2d, 0x03 },
-  { 0x00, 0x1b, 0x02 },
-  { 0x3f, 0x35, 0x07 },
-  { 0x3f, 0x31, 0x06 },
-  { 0x2d, 0x2c, 0x22 },
-  { 0x28, 0x27, 0x1d },
-  { 0x23, 0x22, 0x18 },
-  { 0x1d, 0x1d, 0x12 },
-  { 0x17, 0x17, 0x0f },
-  { 0x11, 0x11, 0x0b },
-  { 0x0a, 0x0a, 0x07 },
-  { 0x05, 0x05, 0x03 },
-  { 0x36, 0x36, 0x36 },
-  { 0x35, 0x32, 0x32 },
-  { 0x32, 0x2e, 0x2e },
-  { 0x2e, 0x2a, 0x2a },
-  { 0x2a, 0x26, 0x26 },
-  { 0x27, 0x22, 0x22 },
-  { 0x23, 0x1e, 0x1e },
-  { 0x1f, 0x1a, 0x1a },
-  { 0x1d, 0x17, 0x17 },
-  { 0x1c, 0x14, 0x14 },
-  { 0x1a, 0x11, 0x11 },
-  { 0x18, 0x0e, 0x0e },
-  { 0x13, 0x0a, 0x0a },
-  { 0x0e, 0x07, 0x07 },
-  { 0x09, 0x04, 0x04 },
-  { 0x3f, 0x2d, 0x06 },
-  { 0x3f, 0x3f, 0x3a },
-  { 0x3f, 0x3b, 0x32 },
-  { 0x3f, 0x2a, 0x05 },
-  { 0x3f, 0x26, 0x04 },
-  { 0x3f, 0x2f, 0x19 },
-  { 0x3f, 0x2b, 0x11 },
-  { 0x3f, 0x27, 0x08 },
-  { 0x3f, 0x22, 0x04 },
-  { 0x38, 0x1e, 0x00 },
-  { 0x32, 0x19, 0x00 },
-  { 0x2b, 0x15, 0x00 },
-  { 0x24, 0x10, 0x00 },
-  { 0x1e, 0x0b, 0x00 },
-  { 0x17, 0x06, 0x00 },
-  { 0x10, 0x01, 0x00 },
-  { 0x0a, 0x00, 0x00 },
-  { 0x36, 0x2f, 0x2c },
-  { 0x33, 0x2b, 0x28 },
-  { 0x31, 0x27, 0x24 },
-  { 0x2e, 0x23, 0x20 },
-  { 0x2b, 0x1f, 0x1c },
-  { 0x29, 0x1c, 0x19 },
-  { 0x24, 0x19, 0x17 },
-  { 0x1f, 0x16, 0x16 },
-  { 0x1b, 0x14, 0x15 },
-  { 0x16, 0x11, 0x13 },
-  { 0x11, 0x0f, 0x12 },
-  { 0x0d, 0x0c, 0x11 },
-  { 0x0a, 0x0a, 0x0d },
-  { 0x07, 0x07, 0x0a },
-  { 0x04, 0x04, 0x06 },
-  { 0x01, 0x02, 0x03 },
-  { 0x35, 0x3b, 0x36 },
-  { 0x2e, 0x36, 0x31 },
-  { 0x26, 0x30, 0x2c },
-  { 0x1f, 0x2a, 0x27 },
-  { 0x17, 0x24, 0x22 },
-  { 0x10, 0x1b, 0x1a },
-  { 0x08, 0x11, 0x12 },
-  { 0x01, 0x07, 0x09 },
-  { 0x3f, 0x32, 0x2b },
-  { 0x3a, 0x2b, 0x25 },
-  { 0x35, 0x24, 0x20 },
-  { 0x2f, 0x1d, 0x1a },
-  { 0x2a, 0x16, 0x15 },
-  { 0x24, 0x10, 0x10 },
-  { 0x1c, 0x0a, 0x0c },
-  { 0x16, 0x04, 0x07 },
-  { 0x37, 0x34, 0x2a },
-  { 0x32, 0x31, 0x28 },
-  { 0x2d, 0x2e, 0x25 },
-  { 0x28, 0x2b, 0x23 },
-  { 0x22, 0x28, 0x21 },
-  { 0x1d, 0x25, 0x1f },
-  { 0x18, 0x22, 0x1d },
-  { 0x13, 0x1f, 0x1a },
-  { 0x11, 0x1b, 0x18 },
-  { 0x0f, 0x18, 0x15 },
-  { 0x0c, 0x14, 0x13 },
-  { 0x0a, 0x11, 0x10 },
-  { 0x07, 0x0d, 0x0d },
-  { 0x05, 0x0a, 0x0b },
-  { 0x03, 0x06, 0x08 },
-  { 0x00, 0x03, 0x05 },
-  { 0x3f, 0x1e, 0x03 },
-  { 0x3f, 0x37, 0x2a },
-  { 0x3f, 0x34, 0x25 },
-  { 0x3f, 0x32, 0x20 },
-  { 0x36, 0x2c, 0x20 },
-  { 0x2c, 0x27, 0x1f },
-  { 0x23, 0x21, 0x1e },
-  { 0x19, 0x1c, 0x1e },
-  { 0x10, 0x16, 0x1d },
-  { 0x06, 0x11, 0x1d },
-  { 0x05, 0x0f, 0x19 },
-  { 0x04, 0x0c, 0x15 },
-  { 0x03, 0x0a, 0x11 },
-  { 0x02, 0x07, 0x0d },
-  { 0x01, 0x05, 0x09 },
-  { 0x3f, 0x1b, 0x03 },
-  { 0x3d, 0x37, 0x33 },
-  { 0x3a, 0x35, 0x2f },
-  { 0x37, 0x32, 0x2a },
-  { 0x33, 0x2f, 0x25 },
-  { 0x30, 0x2c, 0x20 },
-  { 0x2c, 0x29, 0x1b },
-  { 0x29, 0x25, 0x18 },
-  { 0x26, 0x22, 0x16 },
-  { 0x23, 0x1e, 0x13 },
-  { 0x1f, 0x1a, 0x10 },
-  { 0x1a, 0x16, 0x0e },
-  { 0x16, 0x12, 0x0b },
-  { 0x12, 0x0e, 0x08 },
-  { 0x0d, 0x0a, 0x05 },
-  { 0x09, 0x06, 0x02 },
-  { 0x04, 0x01, 0x00 },
-  { 0x3f, 0x39, 0x2e },
-  { 0x3c, 0x33, 0x29 },
-  { 0x38, 0x2d, 0x24 },
-  { 0x34, 0x26, 0x1e },
-  { 0x30, 0x20, 0x19 },
-  { 0x2c, 0x19, 0x14 },
-  { 0x28, 0x13, 0x0e },
-  { 0x24, 0x0d, 0x09 },
-  { 0x21, 0x06, 0x03 },
-  { 0x1d, 0x05, 0x03 },
-  { 0x19, 0x04, 0x02 },
-  { 0x15, 0x04, 0x02 },
-  { 0x11, 0x03, 0x02 },
-  { 0x0d, 0x02, 0x01 },
-  { 0x09, 0x01, 0x01 },
-  { 0x06, 0x01, 0x01 },
-  { 0x3f, 0x36, 0x2c },
-  { 0x3c, 0x31, 0x28 },
-  { 0x39, 0x2d, 0x23 },
-  { 0x36, 0x29, 0x1f },
-  { 0x33, 0x24, 0x1b },
-  { 0x2f, 0x20, 0x16 },
-  { 0x2c, 0x1b, 0x12 },
-  { 0x2a, 0x18, 0x11 },
-  { 0x28, 0x16, 0x10 },
-  { 0x26, 0x13, 0x0f },
-  { 0x24, 0x10, 0x0d },
-  { 0x22, 0x0d, 0x0c },
-  { 0x1a, 0x0a, 0x0a },
-  { 0x11, 0x08, 0x08 },
-  { 0x08, 0x05, 0x06 },
-  { 0x3f, 0x17, 0x02 },
-  { 0x3f, 0x33, 0x2f },
-  { 0x3f, 0x30, 0x2c },
-  { 0x3f, 0x2d, 0x29 },
-  { 0x3e, 0x2a, 0x26 },
-  { 0x3e, 0x27, 0x23 },
-  { 0x3d, 0x24, 0x20 },
-  { 0x3d, 0x20, 0x1e },
-  { 0x3d, 0x1d, 0x1b },
-  { 0x3c, 0x1a, 0x18 },
-  { 0x3c, 0x17, 0x15 },
-  { 0x3b, 0x14, 0x12 },
-  { 0x3b, 0x11, 0x0f },
-  { 0x3b, 0x0e, 0x0c },
-  { 0x3a, 0x0b, 0x0a },
-  { 0x3a, 0x07, 0x07 },
-  { 0x39, 0x04, 0x04 },
-  { 0x39, 0x02, 0x02 },
-  { 0x35, 0x02, 0x02 },
-  { 0x31, 0x01, 0x01 },
-  { 0x2e, 0x01, 0x01 },
-  { 0x2a, 0x01, 0x01 },
-  { 0x26, 0x01, 0x01 },
-  { 0x22, 0x01, 0x01 },
-  { 0x1e, 0x01, 0x01 },
-  { 0x1b, 0x01, 0x01 },
-  { 0x17, 0x01, 0x01 },
-  { 0x13, 0x01, 0x01 },
-  { 0x3f, 0x13, 0x01 },
-  { 0x3f, 0x10, 0x01 },
-  { 0x08, 0x00, 0x00 },
-  { 0x3f, 0x0c, 0x00 },
-  { 0x0c, 0x2e, 0x2b },
-};
+// Packs every frame into pages of at most size x size, tallest first with a
+// pixel of gutter around each, and writes the pages as paletted PNGs plus a
+// JSON index of where each frame went. UVs have their origin at the top left
+// of the page. Frames with the same pixels share one placement. Returns false
+// if a page could not be written.
+static bool saveAtlas(const std::string& name, const std::vector<Frame>& frames, int32_t size) {
+  static constexpr int32_t gutter = 1;
+  for (auto& f : frames) {
+    size = std::max<int32_t>({size, int32_t(f.data->width) + gutter, int32_t(f.data->height) + gutter});
+  }
+  std::vector<size_t> order(frames.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    if (frames[a].data->height != frames[b].data->height) return frames[a].data->height > frames[b].data->height;
+    return frames[a].data->width > frames[b].data->width;
+  });
+  struct Place {
+    int32_t page = -1, x = 0, y = 0;
+  };
+  std::vector<Place> places(frames.size());
+  std::vector<SkylinePacker> pages;
+  std::vector<std::vector<size_t>> onPage;
+  std::unordered_multimap<uint64_t, size_t> placed;
+  size_t shared = 0;
+  for (size_t n : order) {
+    const FrameData* data = frames[n].data;
+    if (data->width == 0 || data->height == 0) continue;
+    Place& p = places[n];
+    auto [begin, end] = placed.equal_range(frames[n].pixels);
+    auto first = std::find_if(begin, end, [&](const auto& f) { return DedupFiles::same(frames[f.second].content, frames[n].content); });
+    if (first != end) {
+      p = places[first->second];
+      shared++;
+      continue;
+    }
+    placed.emplace(frames[n].pixels, n);
+    int32_t w = data->width + gutter, h = data->height + gutter;
+    for (size_t i = 0; i < pages.size() && p.page < 0; i++) {
+      if (pages[i].insert(w, h, p.x, p.y)) p.page = i;
+    }
+    if (p.page < 0) {
+      pages.emplace_back(size, size);
+      onPage.emplace_back();
+      pages.back().insert(w, h, p.x, p.y);
+      p.page = pages.size() - 1;
+    }
+    onPage[p.page].push_back(n);
+  }
+  std::vector<uint8_t> pixels;
+  bool ok = true;
+  for (size_t i = 0; i < pages.size(); i++) {
+    pixels.assign(size_t(size) * pages[i].used, transparentIndex);
+    for (size_t n : onPage[i]) {
+      decodeRle(frames[n].data, IndexedSink{pixels.data() + places[n].y * size + places[n].x, size});
+    }
+    std::string page = name + ".atlas." + std::to_string(i) + ".png";
+    if (!savePng(page, size, pages[i].used, PngColor::indexed, [&](size_t y, uint8_t* out) {
+      memcpy(out, pixels.data() + y * size, size);
+    }, workerCount(0))) {
+      fprintf(stderr, "%s: cannot write\n", page.c_str());
+      ok = false;
+    }
+  }
+  FILE* index = fopen((name + ".atlas.json").c_str(), "w");
+  fprintf(index, "{\n\"pages\": [");
+  for (size_t i = 0; i < pages.size(); i++) {
+    fprintf(index, "%s\n  {\"file\": \"%s.atlas.%zu.png\", \"width\": %d, \"height\": %d}", i ? "," : "", name.c_str(), i, size, pages[i].used);
+  }
+  fprintf(index, "\n],\n\"frames\": [");
+  for (size_t n = 0; n < frames.size(); n++) {
+    const FrameData* data = frames[n].data;
+    const Place& p = places[n];
+    double pw = p.page < 0 ? 1 : size, ph = p.page < 0 ? 1 : pages[p.page].used;
+    fprintf(index, "%s\n  {\"shape\": %zu, \"frame\": %zu, \"page\": %d, \"x\": %d, \"y\": %d, \"w\": %u, \"h\": %u, "
+            "\"u0\": %.6f, \"v0\": %.6f, \"u1\": %.6f, \"v1\": %.6f, \"offx\": %d, \"offy\": %d}",
+            n ? "," : "", frames[n].shape, frames[n].frame, p.page, p.x, p.y, data->width, data->height,
+            p.x / pw, p.y / ph, (p.x + data->width) / pw, (p.y + data->height) / ph, data->offx, data->offy);
+  }
+  fprintf(index, "\n]\n}\n");
+  fclose(index);
+  printf("%zu frames in %zu atlas pages of %dx%d, %zu sharing the place of an identical frame\n", frames.size(), pages.size(), size, size, shared);
+  return ok;
+}
 
 int main(int argc, const char** argv) {
+  const char* name = nullptr;
+  bool png = false;
+  int32_t atlas = 0;
+  std::vector<size_t> shapes;
   for (size_t n = 1; n < static_cast<size_t>(argc); n++) {
-    std::vector<uint8_t> data;
-    data.resize(std::filesystem::file_size(argv[n]));
-    std::ifstream(argv[n]).read(reinterpret_cast<char*>(data.data()), data.size());
-    ShpHeader* h = reinterpret_cast<ShpHeader*>(data.data());
-    std::span<FrameHeader> fhs{reinterpret_cast<FrameHeader*>(data.data() + sizeof(ShpHeader)),
-                              reinterpret_cast<FrameHeader*>(data.data() + sizeof(ShpHeader)) + h->count};
-    std::vector<std::span<const uint8_t>> fds;
-    for (auto& fh : fhs) {
-      uint32_t offset = fh.frameOffset & 0x7FFFFFFF;
-      uint32_t size = fh.framesize;
-      fds.emplace_back(data.data() + offset, data.data() + offset + size);
+    if (argv[n] == std::string("-p")) {
+      png = true;
+    } else if (argv[n] == std::string("-a") && n + 1 < static_cast<size_t>(argc)) {
+      atlas = std::stoul(argv[++n]);
+    } else if (!name) {
+      name = argv[n];
+    } else {
+      shapes.push_back(std::stoul(argv[n]));
     }
-    size_t frameno = 0;
-    for (auto& fd : fds) {
-      FrameData* data = (FrameData*)fd.data();
-      std::vector<uint8_t> image{bmpheader.begin(), bmpheader.end()};
-      uint32_t rowstride = data->width * 3;
-      while (rowstride & 0x3) rowstride++;
-      uint32_t imageByteCount = rowstride * data->height;
-      image.resize(imageByteCount + bmpheader.size() + 4096);
-      image[18] = data->width & 0xFF;
-      image[19] = (data->width >> 8) & 0xFF;
-      image[22] = data->height & 0xFF;
-      image[23] = (data->height >> 8) & 0xFF;
-      image[2] = image.size() & 0xFF;
-      image[3] = (image.size() >> 8) & 0xFF;
-      image[4] = (image.size() >> 16) & 0xFF;
-      image[5] = (image.size() >> 24) & 0xFF;
-      image[34] = ((imageByteCount)) & 0xFF;
-      image[35] = ((imageByteCount) >> 8) & 0xFF;
-      image[36] = ((imageByteCount) >> 16) & 0xFF;
-      image[37] = ((imageByteCount) >> 24) & 0xFF;
-      for (size_t row = 0; row < data->height; row++) {
-        uint8_t* rowbuf = image.data() + sizeof(bmpheader) + rowstride * (data->height - row - 1);
-        uint8_t* inbuf = (uint8_t*)&data->rowOffsets[row] + data->rowOffsets[row];
-
-        size_t rowlen = data->rowOffsets[row+1] - data->rowOffsets[row] + 4;
-        printf("%zu\n", rowlen);
-        uint32_t x = 0;
-
-        while(x < data->width) {
-          // Skip N pixels
-          rowbuf += 3 * *inbuf;
-          x += *inbuf;
-          inbuf++;
-          if(x >= data->width)
-            break;
-
-          uint8_t length = *inbuf++;
-          uint8_t type = 0;
-
-          if (data->compression == 1) {
-            type = length & 1;
-            length >>= 1;
-          }
-
-          if(type == 0) {
-            for (size_t n = 0; n < length; n++) {
-              Color& col = palette[*inbuf++];
-              *rowbuf++ = col.b<<2;
-              *rowbuf++ = col.g<<2;
-              *rowbuf++ = col.r<<2;
-            }
-          } else {
-            Color& col = palette[*inbuf];
-            for (size_t n = 0; n < length; n++) {
-              *rowbuf++ = col.b<<2;
-              *rowbuf++ = col.g<<2;
-              *rowbuf++ = col.r<<2;
-            }
-            inbuf++;
-          }
-
-          x += length;
-        }
+  }
+  FlxArchive archive(name);
+  if (shapes.empty()) {
+    for (size_t n = 0; n < archive.size(); n++) shapes.push_back(n);
+  }
+  FrameIndex index = indexFrames(archive, name);
+  std::vector<Frame> frames;
+  for (size_t shape : shapes) {
+    std::span<const uint8_t> data = archive[shape];
+    if (data.empty()) continue;
+    // Broken frames are reported and left out, so the rest can be decoded
+    // without bounds checks.
+    size_t count = std::min(index.frameCount(shape), framesInShape(data));
+    if (data.size() < sizeof(ShpHeader) || count < reinterpret_cast<const ShpHeader*>(data.data())->count) {
+      fprintf(stderr, "%s %zu: frame table cut short at %zu frames\n", name, shape, count);
+    }
+    for (size_t n = 0; n < count; n++) {
+      const FrameData* fdata = index.frameData(archive, shape, n);
+      if (!fdata) {
+        if (const char* error = validateFrame(data, n)) fprintf(stderr, "%s %zu frame %zu: %s\n", name, shape, n, error);
+        continue;
+      }
+      const FrameIndexEntry& e = index.frames(shape)[n];
+      frames.push_back({shape, n, fdata, e.pixels, pixelContent(fdata, e)});
+    }
+  }
+  if (atlas) {
+    return saveAtlas(name, frames, atlas) ? 0 : 1;
+  }
+  // Frames with the same pixels as one already written become links to it.
+  DedupFiles dedup;
+  bool ok = true;
+  for (auto& frame : frames) {
+    const FrameData* data = frame.data;
+    std::vector<uint8_t> image{bmpheader.begin(), bmpheader.end()};
+    uint32_t rowstride = data->width * 3;
+    while (rowstride & 0x3) rowstride++;
+    uint32_t imageByteCount = rowstride * data->height;
+    image.resize(imageByteCount + bmpheader.size());
+    image[18] = data->width & 0xFF;
+    image[19] = (data->width >> 8) & 0xFF;
+    image[22] = data->height & 0xFF;
+    image[23] = (data->height >> 8) & 0xFF;
+    image[2] = image.size() & 0xFF;
+    image[3] = (image.size() >> 8) & 0xFF;
+    image[4] = (image.size() >> 16) & 0xFF;
+    image[5] = (image.size() >> 24) & 0xFF;
+    image[34] = ((imageByteCount)) & 0xFF;
+    image[35] = ((imageByteCount) >> 8) & 0xFF;
+    image[36] = ((imageByteCount) >> 16) & 0xFF;
+    image[37] = ((imageByteCount) >> 24) & 0xFF;
+    std::string out = name + std::string(".") + std::to_string(frame.shape) + "." + std::to_string(frame.frame);
+    if (png && !(data->width && data->height)) continue;
+    if (dedup.link(frame.pixels, out + (png ? ".png" : ".bmp"), frame.content)) continue;
+    if (png) {
+      // Palette indices on a transparentIndex background.
+      std::vector<uint8_t> indices(data->width * data->height, transparentIndex);
+      decodeRle(data, IndexedSink{indices.data(), ptrdiff_t(data->width)});
+      if (!savePng(out + ".png", data->width, data->height, PngColor::indexed, [&](size_t y, uint8_t* rowout) {
+        memcpy(rowout, indices.data() + y * data->width, data->width);
+      })) {
+        fprintf(stderr, "%s.png: cannot write\n", out.c_str());
+        ok = false;
+      }
+    } else {
+      // Straight into the BMP rows, bottom-up.
+      if (data->height) decodeRle(data, Bgr24Sink{image.data() + sizeof(bmpheader) + rowstride * (data->height - 1), -ptrdiff_t(rowstride)});
+      if (!std::ofstream(out + ".bmp").write((const char*)image.data(), image.size()).flush()) {
+        fprintf(stderr, "%s.bmp: cannot write\n", out.c_str());
+        ok = false;
       }
-      image.resize(imageByteCount + bmpheader.size());
-      std::ofstream(argv[n] + std::string(".") + std::to_string(frameno) + ".bmp").write((const char*)image.data(), image.size());
-      frameno++;
     }
-
   }
+  dedup.report("frames");
+  return ok ? 0 : 1;
 }
@@ -2,64 +2,201 @@
 #include <fstream>
 #include <span>
 #include <vector>
+#include <array>
 #include <cstdint>
+#include <cstdio>
+#include <string>
 #include <unordered_map>
 #include <map>
+#include "FlxArchive.h"
+#include "FrameIndex.h"
+#include "Level.h"
+#include "Typeinfo.h"
+#include "Writer.h"
 
-int main(int, const char** argv) {
-  std::vector<uint8_t> data;
-  data.resize(std::filesystem::file_size(argv[1]));
-  std::ifstream(argv[1]).read(reinterpret_cast<char*>(data.data()), data.size());
+struct Box {
+  float x1, x2, y1, y2, z1, z2;
+  std::array<float, 3> key() const {
+    return {x2, y2, z2 - z1};
+  }
+};
+
+// Bounding box of a Typeinfo footprint, centred on the origin. Flat
+// dimensions get a token thickness so the box keeps its faces.
+static Box footprint(const TypeTable& types, size_t n) {
+  float x = n < types.size() ? types.x[n] : 0;
+  float y = n < types.size() ? types.y[n] : 0;
+  float z = n < types.size() ? types.z[n] : 0;
+  if (x == 0) { x = 0.1; }
+  if (y == 0) { y = 0.1; }
+  Box b{-x / 2, x / 2, -y / 2, y / 2, -z / 2, z / 2};
+  if (z == 0) {
+    b.z1 = -0.1;
+  }
+  return b;
+}
+
+static void writeVertices(Writer& out, const Box& b) {
+  for (float x : {b.x1, b.x2}) {
+    for (float z : {b.z1, b.z2}) {
+      for (float y : {b.y1, b.y2}) {
+        out << "v " << double(x) << ' ' << double(z) << ' ' << double(y) << '\n';
+      }
+    }
+  }
+}
+
+static void writeNormalsAndUvs(Writer& out) {
+  out << "vn -1 0 0\nvn 1 0 0\nvn 0 -1 0\nvn 0 1 0\nvn 0 0 -1\nvn 0 0 1\n\n";
+  out << "vt 0 0\nvt 0 1\nvt 1 0\nvt 1 1\n\n";
+}
+
+// Two triangles per side as vertex/uv pairs; the normal is side + 1.
+static constexpr uint8_t boxFaces[12][3][2] = {
+  {{4, 4}, {1, 1}, {3, 2}}, {{1, 1}, {4, 4}, {2, 3}},
+  {{8, 3}, {7, 1}, {5, 2}}, {{5, 2}, {6, 4}, {8, 3}},
+  {{6, 3}, {5, 1}, {1, 2}}, {{1, 2}, {2, 4}, {6, 3}},
+  {{8, 4}, {3, 1}, {7, 2}}, {{3, 1}, {8, 4}, {4, 3}},
+  {{7, 4}, {1, 1}, {5, 2}}, {{1, 1}, {7, 4}, {3, 3}},
+  {{8, 2}, {6, 4}, {2, 3}}, {{2, 3}, {4, 1}, {8, 2}},
+};
+
+static void writeFaces(Writer& out, size_t base) {
+  for (size_t f = 0; f < 12; f++) {
+    out << 'f';
+    for (auto& corner : boxFaces[f]) {
+      out << ' ' << base + corner[0] << '/' << corner[1] << '/' << f / 2 + 1;
+    }
+    out << '\n';
+  }
+}
+
+static void writeMaterial(Writer& mtl, size_t n, size_t f) {
+  mtl << "newmtl crus_" << n - 1 << '_' << f << '\n';
+  mtl << "  Ka 1.000 1.000 1.000\n  Kd 1.000 1.000 1.000\n  Ks 0.000 0.000 0.000\n";
+  mtl << "  map_Ka shapes.flx." << n << '.' << f << ".bmp\n  map_Kd shapes.flx." << n << '.' << f << ".bmp\n\n";
+}
+
+// Writes crusader.mtl with a material for every frame of every shape.
+static void writeMaterials(const FrameIndex& index) {
+  Writer mtl("crusader.mtl");
   for (size_t n = 1; n < 2048; n++) {
-    FILE* mtl = fopen(("crusader_" + std::to_string(n-1) + ".mtl").c_str(), "wb");
-    uint8_t* p = data.data() + n * 9;
-    float x = ((p[2] >> 5) | (p[3] << 3)) & 0x1F;
-    float y = (p[3] >> 2) & 0x1F;
-    float z = ((p[3] >> 7) | (p[4] << 1)) & 0x1F;
-    if (x == 0) { x = 0.1; }
-    if (y == 0) { y = 0.1; }
-    float x1 = -x / 2, x2 = x / 2;
-    float y1 = -y / 2, y2 = y / 2;
-    float z1 = -z / 2, z2 = z / 2;
-    if (z == 0) {
-      z1 = -0.1;
+    size_t frames = index.frameCount(n);
+    for (size_t f = 0; f < frames; f++) {
+      writeMaterial(mtl, n, f);
+    }
+  }
+}
+
+// Writes crusader.obj. Each distinct box is written once, and every frame is
+// a group that points its faces at the shared box with its own material.
+static void writeCombined(const TypeTable& types, const FrameIndex& index) {
+  Writer obj("crusader.obj");
+  obj << "mtllib crusader.mtl\n\n";
+  writeNormalsAndUvs(obj);
+  std::map<std::array<float, 3>, size_t> boxes;
+  size_t groups = 0;
+  for (size_t n = 1; n < 2048; n++) {
+    Box b = footprint(types, n);
+    size_t frames = index.frameCount(n);
+    if (!frames) continue;
+    auto [it, added] = boxes.try_emplace(b.key(), boxes.size() * 8);
+    if (added) {
+      writeVertices(obj, b);
+      obj << '\n';
     }
-    std::vector<uint8_t> sdata;
-    sdata.resize(6);
-    std::ifstream("shapes.flx." + std::to_string(n-1)).read(reinterpret_cast<char*>(sdata.data()), sdata.size());
-    size_t frames = sdata[4] + sdata[5] * 256;
-    printf("%zu\n", frames);
     for (size_t f = 0; f < frames; f++) {
-      fprintf(mtl, "newmtl crus_%zu_%zu\n", n-1, f);
-      fprintf(mtl, "  Ka 1.000 1.000 1.000\n  Kd 1.000 1.000 1.000\n  Ks 0.000 0.000 0.000\n");
-      fprintf(mtl, "  map_Ka shapes.flx.%zu.%zu.bmp\n  map_Kd shapes.flx.%zu.%zu.bmp\n\n", n-1, f, n-1, f);
-      FILE* out = fopen((std::to_string(n - 1) + "_" + std::to_string(f) + ".obj").c_str(), "wb");
-      fprintf(out, "mtllib crusader_%zu.mtl\nusemtl crus_%zu_%zu\n", n-1, n-1, f);
-      fprintf(out, "v %f %f %f\n", x1, z1, y1);
-      fprintf(out, "v %f %f %f\n", x1, z1, y2);
-      fprintf(out, "v %f %f %f\n", x1, z2, y1);
-      fprintf(out, "v %f %f %f\n", x1, z2, y2);
-      fprintf(out, "v %f %f %f\n", x2, z1, y1);
-      fprintf(out, "v %f %f %f\n", x2, z1, y2);
-      fprintf(out, "v %f %f %f\n", x2, z2, y1);
-      fprintf(out, "v %f %f %f\n\n", x2, z2, y2);
+      obj << "g crus_" << n - 1 << '_' << f << "\nusemtl crus_" << n - 1 << '_' << f << '\n';
+      writeFaces(obj, it->second);
+      groups++;
+    }
+  }
+  printf("%zu frames sharing %zu boxes\n", groups, boxes.size());
+}
+
+// Writes <level>.obj with a box for every object in the level, in footprint
+// units and using the frame's material from crusader.mtl. Objects are
+// written as they are read, so memory use stays flat however large the
+// level is. usemtl is only repeated when the frame changes.
+static void writeScene(const TypeTable& types, GlobCache& globs, const std::string& level) {
+  Writer obj(level + ".obj");
+  obj << "mtllib crusader.mtl\n\n";
+  writeNormalsAndUvs(obj);
+  size_t objects = 0, skipped = 0;
+  uint32_t material = 0;
+  forEachShape(level, globs, [&](const Shape& s) {
+    if (s.shape == 0 || s.shape >= 2048 || s.shape >= types.size()) {
+      skipped++;
+      return;
+    }
+    Box b = footprint(types, s.shape);
+    float dx = float(s.x) / footXY - b.x2, dy = float(s.y) / footXY - b.y2, dz = float(s.z) / footZ - b.z1;
+    b = {b.x1 + dx, b.x2 + dx, b.y1 + dy, b.y2 + dy, b.z1 + dz, b.z2 + dz};
+    uint32_t key = s.shape << 8 | s.frame;
+    if (key != material) {
+      obj << "usemtl crus_" << s.shape - 1 << '_' << s.frame << '\n';
+      material = key;
+    }
+    writeVertices(obj, b);
+    writeFaces(obj, objects * 8);
+    objects++;
+  });
+  printf("%s: %zu objects, %zu without a box\n", level.c_str(), objects, skipped);
+}
 
-      fprintf(out, "vn -1 0 0\nvn 1 0 0\nvn 0 -1 0\nvn 0 1 0\nvn 0 0 -1\nvn 0 0 1\n\n");
-      fprintf(out, "vt 0 0\nvt 0 1\nvt 1 0\nvt 1 1\n\n");
-      fprintf(out, "f 4/4/1 1/1/1 3/2/1\n");
-      fprintf(out, "f 1/1/1 4/4/1 2/3/1\n");
-      fprintf(out, "f 8/3/2 7/1/2 5/2/2\n");
-      fprintf(out, "f 5/2/2 6/4/2 8/3/2\n");
-      fprintf(out, "f 6/3/3 5/1/3 1/2/3\n");
-      fprintf(out, "f 1/2/3 2/4/3 6/3/3\n");
-      fprintf(out, "f 8/4/4 3/1/4 7/2/4\n");
-      fprintf(out, "f 3/1/4 8/4/4 4/3/4\n");
-      fprintf(out, "f 7/4/5 1/1/5 5/2/5\n");
-      fprintf(out, "f 1/1/5 7/4/5 3/3/5\n");
-      fprintf(out, "f 8/2/6 6/4/6 2/3/6\n");
-      fprintf(out, "f 2/3/6 4/1/6 8/2/6\n");
-      fclose(out);
+int main(int argc, const char** argv) {
+  std::string mode;
+  const char* name = nullptr;
+  std::vector<const char*> levels;
+  bool bad = false;
+  for (int n = 1; n < argc; n++) {
+    if (argv[n] == std::string("-c") || argv[n] == std::string("-s")) {
+      bad = bad || !mode.empty();
+      mode = argv[n];
+    } else if (argv[n][0] == '-') {
+      bad = true;
+    } else if (!name) {
+      name = argv[n];
+    } else {
+      levels.push_back(argv[n]);
+    }
+  }
+  if (bad || !name || (mode != "-s" && !levels.empty())) {
+    fprintf(stderr, "usage: shapegen typeinfo.dat               one .obj box per shape frame\n"
+                    "       shapegen -c typeinfo.dat            every box in one .obj\n"
+                    "       shapegen -s typeinfo.dat level...   one .obj scene per level\n");
+    return 1;
+  }
+  TypeTable types = TypeTable::load(name);
+  FlxArchive shapeflx("shapes.flx");
+  FrameIndex index = indexFrames(shapeflx, "shapes.flx");
+  if (mode == "-c") {
+    writeMaterials(index);
+    writeCombined(types, index);
+    return 0;
+  }
+  if (mode == "-s") {
+    FlxArchive globflx("glob.flx");
+    GlobCache globs(globflx);
+    writeMaterials(index);
+    for (const char* level : levels) {
+      writeScene(types, globs, level);
+    }
+    return 0;
+  }
+  for (size_t n = 1; n < 2048; n++) {
+    Writer mtl("crusader_" + std::to_string(n-1) + ".mtl");
+    Box b = footprint(types, n);
+    size_t frames = index.frameCount(n);
+    printf("%zu\n", frames);
+    for (size_t f = 0; f < frames; f++) {
+      writeMaterial(mtl, n, f);
+      Writer out(std::to_string(n - 1) + "_" + std::to_string(f) + ".obj");
+      out << "mtllib crusader_" << n - 1 << ".mtl\nusemtl crus_" << n - 1 << '_' << f << '\n';
+      writeVertices(out, b);
+      out << '\n';
+      writeNormalsAndUvs(out);
+      writeFaces(out, 0);
     }
-    fclose(mtl);
   }
 }
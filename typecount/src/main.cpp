@@ -1,70 +1,124 @@
+#include <array>
 #include <filesystem>
 #include <fstream>
+#include <memory>
 #include <span>
+#include <string>
 #include <vector>
 #include <cstdint>
-#include <unordered_map>
+#include "FlxArchive.h"
+#include "Level.h"
+#include "LevelIndex.h"
+#include "Parallel.h"
 
-struct [[gnu::packed]] Entry {
-  uint16_t x;
-  uint16_t y;
-  uint8_t z;
-  uint16_t type;
-  uint8_t frame;
-  uint16_t flags;
-  uint16_t count;
-  uint8_t npcIndex;
-  uint8_t mapIndex;
-  uint16_t nextObj;
+// Counters for every (shape, frame) pair. Each shape gets a dense block of
+// 256 frame counters the first time it is seen, so a level only pays for
+// the shapes it uses and counting is a plain array increment.
+struct Counts {
+  std::vector<std::unique_ptr<std::array<size_t, 256>>> blocks{65536};
+  void add(uint16_t shape, uint8_t frame) {
+    auto& block = blocks[shape];
+    if (!block) block = std::make_unique<std::array<size_t, 256>>();
+    (*block)[frame]++;
+  }
+  void merge(const Counts& rhs) {
+    for (size_t shape = 0; shape < blocks.size(); shape++) {
+      if (!rhs.blocks[shape]) continue;
+      auto& block = blocks[shape];
+      if (!block) block = std::make_unique<std::array<size_t, 256>>();
+      for (size_t frame = 0; frame < 256; frame++) {
+        (*block)[frame] += (*rhs.blocks[shape])[frame];
+      }
+    }
+  }
 };
 
-struct [[gnu::packed]] GlobEntry {
-  uint8_t x;
-  uint8_t y;
-  uint8_t z;
-  uint16_t shapeindex;
-  uint8_t frame;
-};
+void countLevel(GlobCache& globs, const char* name, Counts& counts) {
+  std::vector<uint8_t> data;
+  data.resize(std::filesystem::file_size(name));
+  std::ifstream(name).read(reinterpret_cast<char*>(data.data()), data.size());
+  Entry* firstEntry = reinterpret_cast<Entry*>(data.data());
+  std::span<Entry> entries{firstEntry, firstEntry + data.size() / sizeof(Entry)};
+  for (auto& entry : entries) {
+    switch(entry.type) {
+      case 1003:
+      case 1002:
+      case 1001:
+      fprintf(stderr, "%s\n", name);
+    }
+    if (entry.type == 0x10) {
+      const std::vector<Shape>* glob = globs.get(entry.count);
+      if (!glob) {
+        fprintf(stderr, "invalid glob id %u\n", entry.count);
+      } else {
+        for (auto& g : *glob) {
+          counts.add(g.shape, g.frame);
+        }
+      }
+    } else {
+      counts.add(entry.type, entry.frame);
+    }
+  }
+}
 
-static_assert(sizeof(Entry) == 16);
+// Counts only the objects positioned inside a world rectangle, through the
+// level's spatial index.
+void countRegion(GlobCache& globs, const char* name, const std::array<int32_t, 4>& region, Counts& counts) {
+  LevelIndex index = indexLevel(name, globs);
+  index.query(region[0], region[1], region[2], region[3], [&](const Shape& s) {
+    counts.add(s.shape, s.frame);
+  });
+}
 
 int main(int argc, const char** argv) {
-  std::vector<std::vector<uint8_t>> globs;
-  globs.resize(3072);
-  for (size_t n = 0; n < 3072; n++) {
-    globs[n].resize(std::filesystem::file_size("glob.flx." + std::to_string(n)));
-    std::ifstream("glob.flx." + std::to_string(n)).read(reinterpret_cast<char*>(globs[n].data()), globs[n].size());
-  }
-  std::unordered_map<uint32_t, size_t> counts;
+  std::vector<const char*> levels;
+  std::array<int32_t, 4> region;
+  bool regional = false;
+  size_t jobs = 1;
+  std::string format = "text";
   for (size_t n = 1; n < static_cast<size_t>(argc); n++) {
-    std::vector<uint8_t> data;
-    data.resize(std::filesystem::file_size(argv[n]));
-    std::ifstream(argv[n]).read(reinterpret_cast<char*>(data.data()), data.size());
-    Entry* firstEntry = reinterpret_cast<Entry*>(data.data());
-    std::span<Entry> entries{firstEntry, firstEntry + data.size() / sizeof(Entry)};
-    for (auto& entry : entries) {
-      switch(entry.type) {
-        case 1003:
-        case 1002:
-        case 1001:
-        printf("%s\n", argv[n]);
-      }
-      if (entry.type == 0x10) {
-        if (entry.count >= globs.size()) {
-          printf("invalid glob id %u\n", entry.count);
-        } else {
-          std::vector<uint8_t>& gv = globs[entry.count];
-          std::span<GlobEntry> ge{reinterpret_cast<GlobEntry*>(gv.data() + 2), reinterpret_cast<GlobEntry*>(gv.data() + gv.size())};
-          for (auto& e : ge) {
-            counts[(e.shapeindex << 8) | e.frame]++;
-          }
-        }
+    if (argv[n] == std::string("-j") && n + 1 < static_cast<size_t>(argc)) {
+      jobs = workerCount(std::stoul(argv[++n]));
+    } else if (argv[n] == std::string("-r") && n + 4 < static_cast<size_t>(argc)) {
+      for (auto& r : region) r = std::stoi(argv[++n]);
+      regional = true;
+    } else if (argv[n] == std::string("-f") && n + 1 < static_cast<size_t>(argc)) {
+      format = argv[++n];
+    } else {
+      levels.push_back(argv[n]);
+    }
+  }
+  FlxArchive globflx("glob.flx");
+  GlobCache globs(globflx);
+  std::vector<Counts> counts(jobs);
+  parallelFor(levels.size(), jobs, [&](size_t n, size_t worker) {
+    if (regional) {
+      countRegion(globs, levels[n], region, counts[worker]);
+    } else {
+      countLevel(globs, levels[n], counts[worker]);
+    }
+  });
+  for (size_t n = 1; n < jobs; n++) {
+    counts[0].merge(counts[n]);
+  }
+
+  const char* separator = "";
+  if (format == "csv") printf("shape,frame,count\n");
+  if (format == "json") printf("[");
+  for (size_t shape = 0; shape < counts[0].blocks.size(); shape++) {
+    if (!counts[0].blocks[shape]) continue;
+    for (size_t frame = 0; frame < 256; frame++) {
+      size_t count = (*counts[0].blocks[shape])[frame];
+      if (!count) continue;
+      if (format == "csv") {
+        printf("%zu,%zu,%zu\n", shape, frame, count);
+      } else if (format == "json") {
+        printf("%s\n  {\"shape\": %zu, \"frame\": %zu, \"count\": %zu}", separator, shape, frame, count);
+        separator = ",";
       } else {
-        counts[(entry.type << 8) | entry.frame]++;
+        printf("%zu: %zu/%zu\n", count, shape, frame);
       }
     }
   }
-  for (auto& [id, count] : counts) {
-    printf("%zu: %u/%u\n", count, (id >> 8), (id & 0xFF));
-  }
+  if (format == "json") printf("\n]\n");
 }
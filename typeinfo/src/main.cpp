@@ -1,28 +1,42 @@
 #include <filesystem>
 #include <fstream>
 #include <span>
+#include <string>
 #include <vector>
 #include <cstdint>
+#include <cstdio>
 #include <unordered_map>
+#include "Typeinfo.h"
 
-int main(int, const char** argv) {
-  std::vector<uint8_t> data;
-  data.resize(std::filesystem::file_size(argv[1]));
-  std::ifstream(argv[1]).read(reinterpret_cast<char*>(data.data()), data.size());
-  for (size_t n = 0; n < 2048; n++) {
-    uint8_t* p = data.data() + n * 9;
-    uint16_t flags = (((p[0]) | (p[1] << 8)) & 0xFFF) | (p[6] << 12);
-    uint8_t family = ((p[1] >> 4) | (p[2] << 4)) & 0x1F;
-    uint8_t equip = (p[2] >> 1) & 0xF;
-    uint8_t x = ((p[2] >> 5) | (p[3] << 3)) & 0x1F;
-    uint8_t y = (p[3] >> 2) & 0x1F;
-    uint8_t z = ((p[3] >> 7) | (p[4] << 1)) & 0x1F;
-    uint8_t animtype = (p[4] >> 4) & 0xF;
-    uint8_t animdata = (p[5]) & 0xF;
-    uint8_t animSpeed = (p[5] >> 4) & 0xF;
-    if (animtype && not animSpeed) animSpeed++;
-    uint8_t weight = p[7];
-    uint8_t volume = p[8];
-    printf("%05x %u %u (%u %u %u) (%u %u %u) %u %u\n", flags, family, equip, x, y, z, animtype, animdata, animSpeed, weight, volume);
+// typeinfo typeflag.dat [-f flag]... [-F family]
+// Prints every record, or only the shapes that have all the given flags and
+// belong to the given family.
+int main(int argc, const char** argv) {
+  TypeTable types = TypeTable::load(argv[1]);
+  uint32_t mask = 0;
+  int family = -1;
+  for (size_t n = 2; n < static_cast<size_t>(argc); n++) {
+    if (argv[n] == std::string("-f") && n + 1 < static_cast<size_t>(argc)) {
+      std::string name = argv[++n];
+      size_t found = 0;
+      for (auto& [flag, flagName] : knownFlags) {
+        if (flagName == name) found = flag;
+      }
+      if (!found) {
+        fprintf(stderr, "unknown flag %s; known flags are:", name.c_str());
+        for (auto& [flag, flagName] : knownFlags) fprintf(stderr, " %s", flagName.c_str());
+        fprintf(stderr, "\n");
+        return 1;
+      }
+      mask |= found;
+    } else if (argv[n] == std::string("-F") && n + 1 < static_cast<size_t>(argc)) {
+      family = std::stoi(argv[++n]);
+    }
+  }
+  std::vector<uint16_t> shapes = family < 0 ? types.withFlags(mask) : types.inFamily(family);
+  for (uint16_t n : shapes) {
+    if ((types.flags[n] & mask) != mask) continue;
+    Typeinfo t = types[n];
+    printf("%05x %u %u (%u %u %u) (%u %u %u) %u %u\n", t.flags, t.family, t.equip, t.x, t.y, t.z, t.animtype, t.animdata, t.animSpeed, t.weight, t.volume);
   }
 }